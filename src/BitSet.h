@@ -0,0 +1,87 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#ifdef ARDUINO
+#   include <stdlib.h>
+#   include <stdint.h>
+    namespace std
+    {
+        typedef ::size_t size_t;
+    }
+#else
+#   include <cstdint>
+#   include <cstdlib>
+#endif
+
+/*
+ * Fixed-size set of bits, stored inline so it never allocates. N is rounded
+ * up to whole 32-bit words; up to 32 bits fit in a single uint32_t.
+ */
+template<std::size_t N>
+class BitSet
+{
+private:
+    static const std::size_t WORDS = (N + 31) / 32;
+
+    uint32_t _words[WORDS];
+
+public:
+    BitSet() { clear(); }
+
+    std::size_t capacity() const { return N; }
+
+    void clear() {
+        for (std::size_t ii = 0; ii < WORDS; ii++) {
+            _words[ii] = 0;
+        }
+    }
+
+    // Sets bits [0, n) and clears the rest
+    void fill(std::size_t n) {
+        for (std::size_t ii = 0; ii < WORDS; ii++) {
+            if (n >= 32 * (ii + 1)) {
+                _words[ii] = UINT32_MAX;
+            } else if (n > 32 * ii) {
+                _words[ii] = (UINT32_C(1) << (n - 32 * ii)) - 1;
+            } else {
+                _words[ii] = 0;
+            }
+        }
+    }
+
+    void set(std::size_t idx) {
+        _words[idx / 32] |= UINT32_C(1) << (idx % 32);
+    }
+
+    void reset(std::size_t idx) {
+        _words[idx / 32] &= ~(UINT32_C(1) << (idx % 32));
+    }
+
+    bool test(std::size_t idx) const {
+        return 0 != (_words[idx / 32] & (UINT32_C(1) << (idx % 32)));
+    }
+
+    bool any() const {
+        for (std::size_t ii = 0; ii < WORDS; ii++) {
+            if (_words[ii]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Index of the first set bit at or after idx, or N if there is none
+    std::size_t next(std::size_t idx) const {
+        while (idx < 32 * WORDS) {
+            uint32_t word = _words[idx / 32] >> (idx % 32);
+            if (word) {
+                idx += __builtin_ctzl(word);
+                return idx < N ? idx : N;
+            }
+            idx = (idx / 32 + 1) * 32;
+        }
+        return N;
+    }
+};
+
+#endif /* BITSET_H */
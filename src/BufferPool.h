@@ -0,0 +1,63 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#ifdef ARDUINO
+#   include <stdlib.h>
+#   include <stdint.h>
+    namespace std
+    {
+        typedef ::size_t size_t;
+    }
+#else
+#   include <cstdint>
+#   include <cstdlib>
+#endif
+
+#include "BitSet.h"
+
+/*
+ * N blocks of S bytes, lent out one at a time. The blocks are part of the
+ * pool, so it never allocates; the budget is fixed when it's declared.
+ */
+template<std::size_t S, std::size_t N>
+class BufferPool
+{
+private:
+    uint8_t _blocks[N][S];
+    BitSet<N> _free;
+    std::size_t _available = N;
+
+public:
+    BufferPool() { _free.fill(N); }
+
+    std::size_t capacity() const { return N; }
+    std::size_t available() const { return _available; }
+
+    // A free block, or NULL if they're all lent out
+    uint8_t* acquire() {
+        std::size_t idx = _free.next(0);
+        if (N == idx) {
+            return NULL;
+        }
+
+        _free.reset(idx);
+        _available--;
+        return _blocks[idx];
+    }
+
+    void release(uint8_t* block) {
+        if (NULL == block) {
+            return;
+        }
+
+        std::size_t idx = (block - _blocks[0]) / S;
+        if (idx >= N || _free.test(idx)) {
+            return; // Not one of ours, or already back
+        }
+
+        _free.set(idx);
+        _available++;
+    }
+};
+
+#endif /* BUFFERPOOL_H */
@@ -0,0 +1,106 @@
+#ifndef BYTESCAN_H
+#define BYTESCAN_H
+
+/*
+ * Finds the first byte in a block that is one of a few terminators, without
+ * copying anything. Host builds compare 16 bytes at a time with SSE2, or 32
+ * with AVX2 when compiled with -mavx2. Other targets fall back to memchr for
+ * one terminator and a plain loop for more.
+ */
+#ifdef ARDUINO
+#   include <stdlib.h>
+#   include <stdint.h>
+#   include <string.h>
+    namespace std
+    {
+        typedef ::size_t size_t;
+    }
+#else
+#   include <cstdint>
+#   include <cstring>
+#endif
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+// Scalar version, also used for the tail the vector loops leave over
+template<std::size_t K>
+inline const uint8_t* byteScanScalar(const uint8_t* p, std::size_t n,
+                                        const uint8_t (&terms)[K])
+{
+    for (std::size_t ii = 0; ii < n; ii++) {
+        for (std::size_t kk = 0; kk < K; kk++) {
+            if (terms[kk] == p[ii]) {
+                return p + ii;
+            }
+        }
+    }
+    return NULL;
+}
+
+inline const uint8_t* byteScanScalar(const uint8_t* p, std::size_t n,
+                                        const uint8_t (&terms)[1])
+{
+    return static_cast<const uint8_t*>(memchr(p, terms[0], n));
+}
+
+// First byte of p[0, n) found in terms, or NULL
+template<std::size_t K>
+inline const uint8_t* byteScan(const uint8_t* p, std::size_t n,
+                                const uint8_t (&terms)[K])
+{
+    std::size_t ii = 0;
+
+#if defined(__AVX2__)
+    __m256i wide[K];
+    for (std::size_t kk = 0; kk < K; kk++) {
+        wide[kk] = _mm256_set1_epi8(terms[kk]);
+    }
+
+    for (; ii + 32 <= n; ii += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + ii));
+        __m256i hits = _mm256_cmpeq_epi8(v, wide[0]);
+        for (std::size_t kk = 1; kk < K; kk++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(v, wide[kk]));
+        }
+
+        uint32_t mask = _mm256_movemask_epi8(hits);
+        if (mask) {
+            return p + ii + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    __m128i narrow[K];
+    for (std::size_t kk = 0; kk < K; kk++) {
+        narrow[kk] = _mm_set1_epi8(terms[kk]);
+    }
+
+    for (; ii + 16 <= n; ii += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + ii));
+        __m128i hits = _mm_cmpeq_epi8(v, narrow[0]);
+        for (std::size_t kk = 1; kk < K; kk++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, narrow[kk]));
+        }
+
+        uint32_t mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return p + ii + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    return byteScanScalar(p + ii, n - ii, terms);
+}
+
+inline const uint8_t* byteScan(const uint8_t* p, std::size_t n, uint8_t c)
+{
+    const uint8_t terms[] = {c};
+    return byteScan(p, n, terms);
+}
+
+#endif /* BYTESCAN_H */
@@ -0,0 +1,66 @@
+#ifdef ARDUINO
+#include "CC3000Transport.h"
+
+CC3000Server::CC3000Server(uint16_t port)
+    : _server(port)
+{
+    for (size_t ii = 0; ii < MAX_SERVER_CLIENTS; ii++) {
+        _connected[ii] = false;
+        _writable[ii] = false;
+        _suspended[ii] = false;
+    }
+}
+
+size_t CC3000Server::poll(TransportEvent* events, size_t n, int timeout)
+{
+    (void)timeout;
+    size_t count = 0;
+
+    /* Find disconnected clients */
+    for (size_t ii = 0; ii < MAX_SERVER_CLIENTS && count < n; ii++) {
+        if (_connected[ii] && !_server.getClientRef(ii).connected()) {
+            _connected[ii] = false;
+            _writable[ii] = false;
+            _suspended[ii] = false;
+            events[count++] = {ii, transport_event::DISCONNECTED};
+        }
+    }
+
+    /* Accept new clients */
+    bool newClient = false;
+    _server.availableIndex(&newClient);
+
+    if (newClient) {
+        for (size_t ii = 0; ii < MAX_SERVER_CLIENTS && count < n; ii++) {
+            if (!_connected[ii] && _server.getClientRef(ii).connected()) {
+                _connected[ii] = true;
+                events[count++] = {ii, transport_event::CONNECTED};
+            }
+        }
+    }
+
+    /*
+     * Report new data. availableIndex() only names the lowest slot with
+     * input, which would let one busy client shut out the rest; so every
+     * slot is asked, starting one further along each time.
+     */
+    for (size_t jj = 0; jj < MAX_SERVER_CLIENTS && count < n; jj++) {
+        size_t ii = (_firstReadable + jj) % MAX_SERVER_CLIENTS;
+        if (_connected[ii] && !_suspended[ii]
+                && 0 < _server.getClientRef(ii).available()) {
+            events[count++] = {ii, transport_event::READABLE};
+        }
+    }
+    _firstReadable = (_firstReadable + 1) % MAX_SERVER_CLIENTS;
+
+    /* The CC3000 buffers writes itself, so a waiting client can always go */
+    for (size_t ii = 0; ii < MAX_SERVER_CLIENTS && count < n; ii++) {
+        if (_writable[ii]) {
+            _writable[ii] = false;
+            events[count++] = {ii, transport_event::WRITABLE};
+        }
+    }
+
+    return count;
+}
+#endif /* ARDUINO */
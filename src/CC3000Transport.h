@@ -0,0 +1,66 @@
+#ifndef CC3000TRANSPORT_H
+#define CC3000TRANSPORT_H
+
+/*
+ * Transport used on the device. The Adafruit client reference already has
+ * the interface HTTP_Client expects, so it is used as-is. The server is
+ * wrapped so the polling the CC3000 needs is turned into TransportEvents.
+ *
+ * The client stays on RingBuffer's per-byte readFrom path: its block read
+ * goes straight to recv() and skips bytes already in the client's own buffer.
+ */
+#include <Adafruit_CC3000.h>
+#include "TransportEvent.h"
+
+class CC3000Server
+{
+private:
+    Adafruit_CC3000_Server _server;
+    bool _connected[MAX_SERVER_CLIENTS];
+    bool _writable[MAX_SERVER_CLIENTS];
+    bool _suspended[MAX_SERVER_CLIENTS];
+    size_t _firstReadable = 0;   // Where the next poll() starts looking
+
+public:
+    explicit CC3000Server(uint16_t port);
+
+    void begin() { _server.begin(); }
+
+    Adafruit_CC3000_ClientRef getClientRef(size_t idx) {
+        return _server.getClientRef(idx);
+    }
+
+    size_t poll(TransportEvent* events, size_t n, int timeout);
+    void notifyWritable(size_t idx) { _writable[idx] = true; }
+
+    // Stop reporting input, leaving it on the CC3000, and start again
+    void suspendReads(size_t idx) { _suspended[idx] = true; }
+    void resumeReads(size_t idx) { _suspended[idx] = false; }
+
+    // There's no half-close, so only the wait before closing is left
+    void shutdown(size_t idx) { (void)idx; }
+};
+
+typedef CC3000Server HTTP_TransportServer;
+typedef Adafruit_CC3000_ClientRef HTTP_TransportClient;
+
+#define HTTP_TRANSPORT_RXBUFFERSIZE RXBUFFERSIZE
+#define HTTP_TRANSPORT_MAX_CLIENTS MAX_SERVER_CLIENTS
+
+// Every client gets one, so keep it small
+#define HTTP_TRANSPORT_TXBUFFERSIZE 64
+
+// Requests are parsed as they come in, so few clients hold input at once
+#define HTTP_TRANSPORT_BUFFERS 2
+
+// Enough for every slot to disconnect, reconnect, and be readable and
+// writable at once
+#define HTTP_TRANSPORT_EVENTS (4 * MAX_SERVER_CLIENTS)
+
+// The CC3000 has to be polled, so there is no point waiting
+#define HTTP_TRANSPORT_POLL_TIMEOUT 0
+
+// Time for the CC3000 to send what it has before the socket goes
+#define HTTP_TRANSPORT_CLOSE_TIMEOUT 100
+
+#endif /* CC3000TRANSPORT_H */
@@ -0,0 +1,31 @@
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#ifdef ARDUINO
+#   include <stdlib.h>
+#   include <stdint.h>
+    namespace std
+    {
+        typedef ::size_t size_t;
+    }
+#else
+#   include <cstdint>
+#   include <cstdlib>
+#endif
+
+/*
+ * 32-bit FNV-1a, a hash that can be taken a piece at a time: start from
+ * FNV_OFFSET and feed each piece the result of the last. Fine for telling
+ * ETags and file contents apart, not for anything an attacker picks.
+ */
+static const uint32_t FNV_OFFSET = 2166136261u;
+
+inline uint32_t fnv1a(uint32_t h, const uint8_t* p, std::size_t n)
+{
+    for (std::size_t ii = 0; ii < n; ii++) {
+        h = (h ^ p[ii]) * 16777619u;
+    }
+    return h;
+}
+
+#endif /* FNV1A_H */
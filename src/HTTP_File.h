@@ -0,0 +1,24 @@
+#ifndef HTTP_FILE_H
+#define HTTP_FILE_H
+
+/*
+ * Files for HTTP_Client::respondWithFile() and writeFile(). On the device
+ * they come from the SD card, on other hosts from the filesystem, both with
+ * the same small interface:
+ *
+ *     bool open(const char* path);
+ *     bool isOpen();
+ *     void close();
+ *     bool size(size_type* n);            // False if it can't be known
+ *     uint32_t tag();                     // Changes when the file does
+ *     int read(uint8_t* buf, size_t n);   // 0 at the end, < 0 on errors
+ */
+#ifdef ARDUINO
+#   include "SDFile.h"
+    typedef SDFile HTTP_File;
+#else
+#   include "PosixFile.h"
+    typedef PosixFile HTTP_File;
+#endif
+
+#endif /* HTTP_FILE_H */
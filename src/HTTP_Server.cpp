@@ -1,7 +1,7 @@
 #include "HTTP_Server.h"
+#include "FNV1a.h"
 
 #ifndef HTTP_SILENT
-#include <avr/pgmspace.h>
 static const char gError[] PROGMEM = "ERROR";
 static const char gDebug[] PROGMEM = "DEBUG";
 
@@ -66,6 +66,8 @@ const __FlashStringHelper* HTTPStatusToString(http_status status)
             return F("FAIL_UNSUPPORTED");
         case http_status::FAIL_BAD_REQUEST:
             return F("FAIL_BAD_REQUEST");
+        case http_status::FAIL_METHOD_NOT_ALLOWED:
+            return F("FAIL_METHOD_NOT_ALLOWED");
     }
 }
 
@@ -73,30 +75,75 @@ const __FlashStringHelper* HTTPStatusToString(http_status status)
 /*****************************************************************************
  * HTTP_Client Implementation                                                *
  *****************************************************************************/
-const static char HTTP_V_1_0[] PROGMEM = "HTTP/1.0";
-const static char HTTP_V_1_1[] PROGMEM = "HTTP/1.1";
-const static char* HTTP_VERSIONS[] = {HTTP_V_1_0, HTTP_V_1_1};
-
-StringComparator HTTP_Client::_versionComparator(HTTP_VERSIONS, 2);
-
-const static char HTTP_TRANSFER_ENCODING[] PROGMEM = "Transfer-Encoding";
-const static char HTTP_CONTENT_LENGTH[] PROGMEM    = "Content-Length";
-const static char* HTTP_HEADERS[] = {HTTP_TRANSFER_ENCODING, HTTP_CONTENT_LENGTH};
-
-StringComparator HTTP_Client::_headerComparator(HTTP_HEADERS, 2);
-
-static const char TRANSFER_ENCODING_CHUNKED[] PROGMEM = "chunked";
-static const char* TRANSFER_ENCODINGS[] = {TRANSFER_ENCODING_CHUNKED};
-StringComparator HTTP_Client::_transferEncodingComparator(TRANSFER_ENCODINGS, 1);
+/*
+ * The strings below are only read at compile time, to build the matching
+ * tables; the order of each list gives the index hasMatch() returns. Header
+ * names and these header values are case-insensitive, the method and version
+ * aren't.
+ */
+constexpr const char* const HTTP_METHODS[] = {"GET", "HEAD", "POST", "PUT",
+                                                "DELETE", "OPTIONS", "PATCH",
+                                                "TRACE", "CONNECT"};
+StringComparator HTTP_Client::_methodComparator = STRING_COMPARATOR(HTTP_METHODS);
+
+// Anything longer can't be a method we know, so it's rejected right away
+static const size_t HTTP_MAX_METHOD_LENGTH = StringDfaStrings<HTTP_METHODS,
+    sizeof(HTTP_METHODS) / sizeof(HTTP_METHODS[0]), false>::maxLength();
+
+constexpr const char* const HTTP_VERSIONS[] = {"HTTP/1.0", "HTTP/1.1"};
+StringComparator HTTP_Client::_versionComparator = STRING_COMPARATOR(HTTP_VERSIONS);
+
+constexpr const char* const HTTP_HEADERS[] = {HTTP_BUILTIN_HEADERS};
+StringComparator HTTP_Client::_headerComparator
+    = STRING_COMPARATOR_NOCASE(HTTP_HEADERS);
+const HTTP_HeaderTable HTTP_Client::_builtinHeaders(
+    HTTP_Client::_headerComparator, NULL, 0);
+
+constexpr const char* const TRANSFER_ENCODINGS[] = {"chunked"};
+StringComparator HTTP_Client::_transferEncodingComparator
+    = STRING_COMPARATOR_NOCASE(TRANSFER_ENCODINGS);
+
+constexpr const char* const CONNECTIONS[] = {"close", "keep-alive"};
+StringComparator HTTP_Client::_connectionComparator
+    = STRING_COMPARATOR_NOCASE(CONNECTIONS);
 
 void HTTP_Client::connect()
 {
     _connected = true;
+    _resume = false;
     _buffer.clear();
+    _txBuffer.clear();
+    _chunkOpen = false;
+    _chunkOwed = 0;
+    _txBlocked = false;
+    _finishing = false;
+    _flushes = 0;
+    _timer = http_timer::NONE;
+    _received = 0;
+    _timedOut = false;
+    _closed = false;
+    reset();
+}
+
+// Forgets everything about the current request and response
+void HTTP_Client::reset()
+{
+    _responseState = http_response_state::VERSION;
+    _chunkedResponse = false;
+    _version = http_version::UNKNOWN;
     _header = http_header::UNKNOWN;
+    _routed = false;
     _contentLength = 0;
     _chunked = false;
+    _keepAlive = false;
+    _hasIfNoneMatch = false;
     requestState(http_request_state::METHOD);
+
+    // Not in requestState(), which does nothing for a new connection that's
+    // already in METHOD
+    _method = http_method::UNKNOWN;
+    _methodLength = 0;
+    _comparison = _methodComparator.create();
 }
 
 void HTTP_Client::disconnect()
@@ -104,6 +151,31 @@ void HTTP_Client::disconnect()
     _connected = false;
 }
 
+http_timer HTTP_Client::timer() const
+{
+    if (_txBlocked) {
+        return http_timer::SENDING;
+    }
+
+    switch (_requestState) {
+        case http_request_state::METHOD:
+            return _methodLength ? http_timer::HEADERS : http_timer::IDLE;
+        case http_request_state::BODY:
+            return _chunked || _contentLength ? http_timer::BODY
+                                              : http_timer::NONE;
+        case http_request_state::DONE:
+            return http_timer::NONE;
+        default:
+            return http_timer::HEADERS;
+    }
+}
+
+// Whether input has arrived that the application hasn't got to yet
+bool HTTP_Client::pending()
+{
+    return _buffer.available() || 0 < _client.available();
+}
+
 void HTTP_Client::requestState(http_request_state s)
 {
     if (s != _requestState) {
@@ -111,18 +183,40 @@ void HTTP_Client::requestState(http_request_state s)
         _intParser.reset();
 
         switch (_requestState) {
+            case http_request_state::PATH:
+                _routed = false;
+                _inQuery = false;
+                _comparison = _routes ? _routes->create() : StringComparison();
+                checkPrefixRoute(); // A lone "*" catches everything
+                break;
             case http_request_state::VERSION:
                 _comparison = _versionComparator.create();
                 break;
             case http_request_state::HEADER_NAME:
-                _comparison = _headerComparator.create();
+                _comparison = _headers->_names.create();
                 break;
             case http_request_state::HEADER_VALUE:
                 if (http_header::TRANSFER_ENCODING == _header) {
                     _comparison = _transferEncodingComparator.create();
+                } else if (http_header::CONNECTION == _header) {
+                    _comparison = _connectionComparator.create();
+                } else if (http_header::SUBSCRIBED == _header) {
+                    const HTTP_HeaderSpec& spec = _headers->_specs[_subscribed];
+                    if (http_header_kind::TOKEN == spec.kind && spec.tokens) {
+                        _comparison = spec.tokens->create();
+                    } else {
+                        _comparison = StringComparison();
+                    }
                 }
                 // TODO: Handle Content-Length when applicable
                 break;
+            case http_request_state::BODY:
+                if (_chunked) {
+                    _chunkState = http_chunk_state::SIZE;
+                    _intParser.reset(16);
+                }
+                _comparison = StringComparison();
+                break;
             default:
                 _comparison = StringComparison();
         }
@@ -167,6 +261,32 @@ void HTTP_Client::getTransition(uint8_t& terminator, http_request_state& next)
 http_status HTTP_Client::read(uint8_t* buf, size_t* n_buf,
         http_request_state* current)
 {
+    if (NULL == buf) {
+        error("buf is null");
+        return http_status::FAIL_NULL_ARG;
+    }
+
+    const uint8_t* data;
+    return read(buf, &data, n_buf, current);
+}
+
+http_status HTTP_Client::read(const uint8_t** data, size_t* n_data,
+        http_request_state* current)
+{
+    if (NULL == data) {
+        error("data is null");
+        return http_status::FAIL_NULL_ARG;
+    }
+
+    return read(NULL, data, n_data, current);
+}
+
+http_status HTTP_Client::read(uint8_t* buf, const uint8_t** data,
+        size_t* n_buf, http_request_state* current)
+{
+    // Nothing read yet
+    *data = buf;
+
     if (NULL == n_buf) {
         error("n_buf is null");
         return http_status::FAIL_NULL_ARG;
@@ -182,8 +302,26 @@ http_status HTTP_Client::read(uint8_t* buf, size_t* n_buf,
         return http_status::FAIL_INVALID_ARG;
     }
 
+    if (_timedOut) {
+        *current = _requestState;
+        *n_buf = 0;
+        return http_status::FAIL_TIMEOUT;
+    } else if (_finishing) {
+        *current = _requestState;
+        *n_buf = 0;
+        return http_status::INCOMPLETE;
+    }
+
     int peeked;
 
+    if (http_request_state::METHOD == _requestState) {
+        // Skip blank lines left between pipelined requests
+        for (peeked = _buffer.peek(); '\r' == peeked || '\n' == peeked;
+                peeked = _buffer.peek()) {
+            _buffer.read();
+        }
+    }
+
     // Set the current state
     *current = _requestState;
 
@@ -220,20 +358,84 @@ http_status HTTP_Client::read(uint8_t* buf, size_t* n_buf,
     *current = _requestState;
 
     if (http_request_state::BODY == _requestState) {
-        return readBody(buf, n_buf);
+        return readBody(buf, data, n_buf);
     } else {
-        return readTerminated(buf, n_buf);
+        return readTerminated(buf, data, n_buf);
+    }
+}
+
+// Up to n bytes, from one segment of the buffer
+size_t HTTP_Client::take(uint8_t* buf, const uint8_t** data, size_t n)
+{
+    if (0 == _buffer.available()) {
+        return 0;   // Maybe without even a block to look in
+    }
+
+    if (NULL != buf) {
+        *data = buf;
+        return _buffer.read(buf, n);
+    }
+
+    RingBufferSpan spans[2];
+    if (0 == _buffer.peekSpans(spans)) {
+        return 0;
+    }
+
+    if (n > spans[0].length) {
+        n = spans[0].length;
+    }
+
+    *data = spans[0].data;
+    _buffer.consume(n);
+    return n;
+}
+
+/*
+ * Up to n bytes, stopping after the terminator. Copies cross the end of the
+ * buffer; in place, the piece stops there.
+ */
+size_t HTTP_Client::takeUntil(uint8_t* buf, const uint8_t** data,
+        uint8_t terminator, size_t n)
+{
+    if (0 == _buffer.available()) {
+        return 0;   // Maybe without even a block to look in
+    }
+
+    if (NULL != buf) {
+        *data = buf;
+        return _buffer.readUntil(buf, terminator, n);
+    }
+
+    RingBufferSpan spans[2];
+    if (0 == _buffer.peekSpans(spans)) {
+        return 0;
+    }
+
+    if (n > spans[0].length) {
+        n = spans[0].length;
+    }
+
+    const uint8_t* hit = byteScan(spans[0].data, n, terminator);
+    if (NULL != hit) {
+        n = hit - spans[0].data + 1;
     }
+
+    *data = spans[0].data;
+    _buffer.consume(n);
+    return n;
 }
 
-http_status HTTP_Client::readBody(uint8_t* buf, size_t* n_buf)
+http_status HTTP_Client::readBody(uint8_t* buf, const uint8_t** data,
+        size_t* n_buf)
 {
     if (_chunked) {
-        return http_status::FAIL_UNSUPPORTED; // TODO: support this
+        return readChunked(buf, data, n_buf);
     }
 
-    *n_buf = min(*n_buf, _contentLength);
-    *n_buf = _buffer.read(buf, *n_buf);
+    if (*n_buf > _contentLength) {
+        *n_buf = _contentLength;
+    }
+    *n_buf = take(buf, data, *n_buf);
 
     _contentLength -= *n_buf;
 
@@ -245,7 +447,134 @@ http_status HTTP_Client::readBody(uint8_t* buf, size_t* n_buf)
     }
 }
 
-http_status HTTP_Client::readTerminated(uint8_t* buf, size_t* n_buf)
+/*
+ * Decodes a chunked body as it streams through the ring buffer. The framing
+ * (sizes, extensions, trailers) is consumed a byte at a time and never
+ * returned; chunk data is copied straight into the caller's buffer, or
+ * handed out in place one piece per call.
+ */
+http_status HTTP_Client::readChunked(uint8_t* buf, const uint8_t** data,
+        size_t* n_buf)
+{
+    size_t total = 0;
+    int c;
+
+    while (total < *n_buf) {
+        if (http_chunk_state::DATA == _chunkState) {
+            size_t n = *n_buf - total;
+            if (n > _contentLength) {
+                n = _contentLength;
+            }
+
+            n = take(NULL == buf ? NULL : buf + total, data, n);
+            if (0 == n) {
+                break; // Wait for more data
+            }
+
+            total += n;
+            _contentLength -= n;
+
+            if (0 == _contentLength) {
+                _chunkState = http_chunk_state::DATA_END;
+            }
+
+            if (NULL == buf) {
+                break; // Pieces in place can't be joined up
+            }
+
+            *data = buf;
+            continue;
+        }
+
+        c = _buffer.read();
+        if (0 > c) {
+            break; // Wait for more data
+        }
+
+        http_status status = chunkFraming(c);
+        if (http_status::OKAY != status) {
+            *n_buf = total;
+            return status;
+        }
+
+        if (http_request_state::DONE == _requestState) {
+            *n_buf = total;
+            return http_status::OKAY;
+        }
+    }
+
+    *n_buf = total;
+    return http_status::INCOMPLETE;
+}
+
+http_status HTTP_Client::chunkFraming(uint8_t c)
+{
+    bool hex = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')
+                || (c >= 'A' && c <= 'F');
+
+    switch (_chunkState) {
+        case http_chunk_state::SIZE:
+            if (!hex) {
+                error("chunk size missing");
+                return http_status::FAIL_BAD_REQUEST;
+            }
+            _intParser.next(c);
+            _chunkState = http_chunk_state::SIZE_DIGITS;
+            break;
+        case http_chunk_state::SIZE_DIGITS:
+            if (hex) {
+                _intParser.next(c);
+                break;
+            }
+            _chunkState = http_chunk_state::EXTENSION;
+            // Fall through - the size may end with the line
+        case http_chunk_state::EXTENSION:
+            if ('\n' != c) {
+                break;
+            }
+
+            if (!_intParser.value(&_contentLength)) {
+                error("chunk size too long");
+                return http_status::FAIL_UNSUPPORTED;
+            }
+
+            if (0 == _contentLength) {
+                _chunkState = http_chunk_state::TRAILER; // Last chunk
+            } else {
+                _chunkState = http_chunk_state::DATA;
+            }
+            break;
+        case http_chunk_state::DATA_END:
+            if ('\n' == c) {
+                _chunkState = http_chunk_state::SIZE;
+                _intParser.reset(16);
+            } else if ('\r' != c) {
+                error("chunk data too long");
+                return http_status::FAIL_BAD_REQUEST;
+            }
+            break;
+        case http_chunk_state::TRAILER:
+            if ('\n' == c) {
+                requestState(http_request_state::DONE);
+            } else if ('\r' != c) {
+                _chunkState = http_chunk_state::TRAILER_LINE;
+            }
+            break;
+        case http_chunk_state::TRAILER_LINE:
+            if ('\n' == c) {
+                _chunkState = http_chunk_state::TRAILER;
+            }
+            break;
+        default:
+            error("bad chunk state");
+            return http_status::FAIL_INVALID_STATE;
+    }
+
+    return http_status::OKAY;
+}
+
+http_status HTTP_Client::readTerminated(uint8_t* buf, const uint8_t** data,
+        size_t* n_buf)
 {
     int peeked;
 
@@ -256,21 +585,22 @@ http_status HTTP_Client::readTerminated(uint8_t* buf, size_t* n_buf)
     getTransition(terminator, next);
 
     // Read until we hit the terminator, or run out of buffer space
-    *n_buf = _buffer.readUntil(buf, terminator, *n_buf);
+    *n_buf = takeUntil(buf, data, terminator, *n_buf);
+    const uint8_t* bytes = *data;
 
     http_status retval = http_status::INCOMPLETE;
 
     if (*n_buf == 0) {
         // No new bytes available to be read
         retval = http_status::INCOMPLETE;
-    } else if (terminator == buf[*n_buf-1]) {
+    } else if (terminator == bytes[*n_buf-1]) {
         // Got the terminator
         *n_buf -= 1;
         transition = true;
         retval = http_status::OKAY;
 
         if ('\n' == terminator) {
-            if (*n_buf >= 1 && buf[*n_buf-1] == '\r') {
+            if (*n_buf >= 1 && bytes[*n_buf-1] == '\r') {
                 *n_buf -= 1; // Strip the '\r' from the returned string
             }
         } else if (':' == terminator) {
@@ -286,14 +616,32 @@ http_status HTTP_Client::readTerminated(uint8_t* buf, size_t* n_buf)
                 // Jump to the next state
             }
         }
-    } else if ('\n' == terminator && '\r' == buf[*n_buf-1]) {
-        // Put the '\r' back so that it always comes with its matching '\n'
-        _buffer.putBack('\r');
-        *n_buf -= 1;
+    } else if ('\n' == terminator && '\r' == bytes[*n_buf-1]) {
+        peeked = _buffer.peek();
+        if (0 > peeked) {
+            // Put the '\r' back so that it always comes with its matching '\n'
+            _buffer.putBack('\r');
+            *n_buf -= 1;
+        } else if ('\n' == peeked) {
+            // The caller's buffer filled up right after the '\r'; take the
+            // '\n' now rather than hand the '\r' back on its own.
+            _buffer.read();
+            *n_buf -= 1;
+            transition = true;
+            retval = http_status::OKAY;
+        }
+    }
+
+    if (http_request_state::METHOD == _requestState) {
+        _methodLength += *n_buf;
+        if (_methodLength > HTTP_MAX_METHOD_LENGTH) {
+            error("method too long");
+            return http_status::FAIL_BAD_REQUEST;
+        }
     }
 
     // Advance the comparator
-    processState(buf, *n_buf);
+    processState(bytes, *n_buf, transition);
 
     if (transition) {
         // Check to see if the comparator matches anything
@@ -309,36 +657,168 @@ http_status HTTP_Client::readTerminated(uint8_t* buf, size_t* n_buf)
     return retval;
 }
 
-void HTTP_Client::processState(uint8_t* buf, size_t n_buf)
+void HTTP_Client::processState(const uint8_t* buf, size_t n_buf, bool last)
 {
-    if (0 >= n_buf) {
-        return;
-    }
-
     bool str = true;
 
     switch (_requestState) {
+        case http_request_state::PATH:
+            processPath(buf, n_buf);
+            return;
+        case http_request_state::METHOD:
         case http_request_state::VERSION:
         case http_request_state::HEADER_NAME:
             break;
         case http_request_state::HEADER_VALUE:
-            str = _header != http_header::CONTENT_LENGTH;
+            if (http_header::SUBSCRIBED == _header) {
+                const HTTP_HeaderSpec& spec = _headers->_specs[_subscribed];
+                if (http_header_kind::SPAN == spec.kind) {
+                    // Hand the piece straight on, even if it's empty but
+                    // ends the value
+                    if (0 < n_buf || last) {
+                        http_header_event e = {};
+                        e.header = _subscribed;
+                        e.kind = spec.kind;
+                        e.valid = true;
+                        e.last = last;
+                        e.data = buf;
+                        e.length = n_buf;
+                        header(e);
+                    }
+                    return;
+                }
+                str = http_header_kind::TOKEN == spec.kind;
+            } else if (http_header::IF_NONE_MATCH == _header) {
+                readIfNoneMatch(buf, n_buf);
+                return;
+            } else {
+                str = _header != http_header::CONTENT_LENGTH;
+            }
             break;
         default:
             return;
     }
 
+    if (0 >= n_buf) {
+        return;
+    }
+
     if (str) {
         for (size_t ii = 0; ii < n_buf; ii++) {
             _comparison.next(buf[ii]);
         }
     } else {
-        for (size_t ii = 0; ii < n_buf; ii++) {
-            _intParser.next(buf[ii]);
+        _intParser.feed(buf, n_buf);
+    }
+}
+
+void HTTP_Client::processPath(const uint8_t* buf, size_t n_buf)
+{
+    if (NULL == _routes || _inQuery) {
+        return;
+    }
+
+    for (size_t ii = 0; ii < n_buf; ii++) {
+        if ('?' == buf[ii]) {
+            _inQuery = true;
+            return;
+        }
+        _comparison.next(buf[ii]);
+        checkPrefixRoute();
+    }
+}
+
+/*
+ * The If-None-Match list (RFC 7232 3.2), a piece at a time: "*", or entity
+ * tags separated by commas, each optionally "W/" and then a quoted opaque
+ * tag. A tag only counts once its closing quote arrives, and anything that
+ * isn't one is skipped to the next comma. Repeated headers add to the list.
+ */
+void HTTP_Client::readIfNoneMatch(const uint8_t* buf, size_t n_buf)
+{
+    for (size_t ii = 0; ii < n_buf; ii++) {
+        uint8_t c = buf[ii];
+        bool room = _ifNoneMatchCount < HTTP_IF_NONE_MATCH_TAGS;
+
+        switch (_etagState) {
+            case http_etag_state::BETWEEN:
+                if (' ' == c || '\t' == c || ',' == c) {
+                    break;
+                } else if ('*' == c) {
+                    _ifNoneMatchAny = true;
+                    _etagState = http_etag_state::SKIP;
+                } else if ('W' == c) {
+                    _etagState = http_etag_state::WEAK;
+                } else if ('"' == c) {
+                    if (room) {
+                        _ifNoneMatch[_ifNoneMatchCount] = FNV_OFFSET;
+                    }
+                    _etagState = http_etag_state::TAG;
+                } else {
+                    _etagState = http_etag_state::SKIP;
+                }
+                break;
+            case http_etag_state::WEAK:
+                _etagState = '/' == c
+                    ? http_etag_state::OPEN : http_etag_state::SKIP;
+                break;
+            case http_etag_state::OPEN:
+                if ('"' == c) {
+                    if (room) {
+                        _ifNoneMatch[_ifNoneMatchCount] = FNV_OFFSET;
+                    }
+                    _etagState = http_etag_state::TAG;
+                } else {
+                    _etagState = http_etag_state::SKIP;
+                }
+                break;
+            case http_etag_state::TAG: {
+                // Hash up to the closing quote, or all of this piece
+                const uint8_t* quote = static_cast<const uint8_t*>(
+                    memchr(buf + ii, '"', n_buf - ii));
+                size_t end = quote ? quote - buf : n_buf;
+                if (room) {
+                    _ifNoneMatch[_ifNoneMatchCount] = fnv1a(
+                        _ifNoneMatch[_ifNoneMatchCount], buf + ii, end - ii);
+                }
+                ii = end;
+                if (quote) {
+                    if (room) {
+                        _ifNoneMatchCount++;
+                    }
+                    _etagState = http_etag_state::SKIP;
+                }
+                break;
+            }
+            case http_etag_state::SKIP:
+                if (',' == c) {
+                    _etagState = http_etag_state::BETWEEN;
+                }
+                break;
         }
     }
 }
 
+// Remembers the route ending in '*' that the path so far would complete
+void HTTP_Client::checkPrefixRoute()
+{
+    StringComparison star = _comparison;
+    star.next('*');
+
+    size_t idx;
+    if (star.hasMatch(idx)) {
+        _route = idx;
+        _routed = true;
+    }
+}
+
+bool HTTP_Client::route(size_t& idx) const
+{
+    if (_routed) {
+        idx = _route;
+    }
+    return _routed;
+}
 
 http_status HTTP_Client::checkState()
 {
@@ -346,6 +826,11 @@ http_status HTTP_Client::checkState()
     if (!_comparison.hasMatch(idx)) {
         // No matching header/version/whatever...
         switch (_requestState) {
+            case http_request_state::METHOD:
+                error("unknown method");
+                return http_status::FAIL_UNSUPPORTED;
+            case http_request_state::PATH:
+                break;                  // Keep any prefix route
             case http_request_state::VERSION:
                 _version = http_version::UNKNOWN;
                 break;
@@ -363,14 +848,23 @@ http_status HTTP_Client::checkState()
         }
     } else {
         switch (_requestState) {
+            case http_request_state::METHOD:
+                _method = static_cast<http_method>(idx + 1);
+                break;
+            case http_request_state::PATH:
+                _route = idx;
+                _routed = true;
+                break;
             case http_request_state::VERSION:
                 switch (idx) {
                     case 0:
                         _version = http_version::HTTP_1_0;
+                        _keepAlive = false;
                         debug("Got HTTP/1.0");
                         break;
                     case 1:
                         _version = http_version::HTTP_1_1;
+                        _keepAlive = true; // Unless told otherwise
                         debug("Got HTTP/1.1");
                         break;
                     default:
@@ -388,9 +882,27 @@ http_status HTTP_Client::checkState()
                         _header = http_header::CONTENT_LENGTH;
                         debug("Got CONTENT_LENGTH");
                         break;
+                    case 2:
+                        _header = http_header::CONNECTION;
+                        debug("Got CONNECTION");
+                        break;
+                    case 3:
+                        _header = http_header::IF_NONE_MATCH;
+                        _etagState = http_etag_state::BETWEEN;
+                        if (!_hasIfNoneMatch) {
+                            _hasIfNoneMatch = true;
+                            _ifNoneMatchAny = false;
+                            _ifNoneMatchCount = 0;
+                        }
+                        break;
                     default:
-                        error("header name comparator returned bad header");
-                        return http_status::FAIL_INVALID_STATE;
+                        if (idx - HTTP_BUILTIN_HEADER_COUNT >= _headers->_count) {
+                            error("header name comparator returned bad header");
+                            return http_status::FAIL_INVALID_STATE;
+                        }
+                        _header = http_header::SUBSCRIBED;
+                        _subscribed = idx - HTTP_BUILTIN_HEADER_COUNT;
+                        break;
                 }
                 break;
             case http_request_state::HEADER_VALUE:
@@ -404,6 +916,18 @@ http_status HTTP_Client::checkState()
                             error("transfer encoding comparator return bad value");
                             return http_status::FAIL_INVALID_STATE;
                     }
+                } else if (http_header::CONNECTION == _header) {
+                    switch (idx) {
+                        case 0:
+                            _keepAlive = false;
+                            break;
+                        case 1:
+                            _keepAlive = true;
+                            break;
+                        default:
+                            error("connection comparator returned bad value");
+                            return http_status::FAIL_INVALID_STATE;
+                    }
                 }
                 break;
             default:
@@ -411,9 +935,15 @@ http_status HTTP_Client::checkState()
         }
     }
 
+    if (http_request_state::PATH == _requestState && _routed && _routeMethods
+            && !(_routeMethods[_route] & HTTPMethodBit(_method))) {
+        error("method not allowed on route");
+        return http_status::FAIL_METHOD_NOT_ALLOWED;
+    }
+
     if (http_request_state::HEADER_VALUE == _requestState
             && http_header::CONTENT_LENGTH == _header) {
-        uintmax_t len;
+        HTTP_LENGTH_TYPE len;
         if (_intParser.value(&len)) {
             _contentLength = len;
         } else if (_intParser.overflowed()) {
@@ -427,12 +957,46 @@ http_status HTTP_Client::checkState()
             return http_status::FAIL_INVALID_STATE;
         }
     }
+
+    if (http_request_state::HEADER_VALUE == _requestState
+            && http_header::SUBSCRIBED == _header) {
+        const HTTP_HeaderSpec& spec = _headers->_specs[_subscribed];
+        if (http_header_kind::SPAN != spec.kind) {
+            // The whole value's in, so report what it came to
+            http_header_event e = {};
+            e.header = _subscribed;
+            e.kind = spec.kind;
+            e.last = true;
+            if (http_header_kind::INTEGER == spec.kind) {
+                e.valid = _intParser.value(&e.integer);
+            } else {
+                e.valid = _comparison.hasMatch(e.token);
+            }
+            header(e);
+        }
+    }
     return http_status::OKAY;
 }
 
+// Hex digits of the longest chunk size, plus CRLF
+static const size_t CHUNK_HEADER_SIZE = 2 * sizeof(size_t) + 2;
+
+// "0\r\n\r\n", which the end of the transmit buffer is always kept free for
+static const size_t LAST_CHUNK_SIZE = 5;
+
+// A chunk's header and trailing CRLF, with room for the last chunk after it
+static const size_t CHUNK_OVERHEAD = CHUNK_HEADER_SIZE + 2 + LAST_CHUNK_SIZE;
+
+static_assert(HTTP_TX_BUFFER_SIZE > CHUNK_OVERHEAD,
+                "HTTP_TX_BUFFER_SIZE is too small to hold a chunk");
+
+// The end of a chunked response's headers, see advanceTo()
+static_assert(HTTP_TX_BUFFER_SIZE >= 32 + LAST_CHUNK_SIZE,
+                "HTTP_TX_BUFFER_SIZE is too small to end the headers");
+
 http_status HTTP_Client::write(uint8_t c)
 {
-    if (1 != _client.write(c)) {
+    if (1 != put(&c, 1)) {
         return http_status::FAIL_HARDWARE;
     }
 
@@ -441,17 +1005,408 @@ http_status HTTP_Client::write(uint8_t c)
 
 size_t HTTP_Client::write(uint8_t* buf, size_t n)
 {
-    return _client.write(buf, n);
+    return put(buf, n);
 }
 
 size_t HTTP_Client::write(const char* str)
 {
-    return _client.fastrprint(str);
+    return put(str, strlen(str));
 }
 
 size_t HTTP_Client::write(const __FlashStringHelper* str)
 {
-    return _client.fastrprint(str);
+    const char* p = reinterpret_cast<const char*>(str);
+    size_t count = 0;
+    uint8_t c;
+
+    while (0 != (c = pgm_read_byte(p + count)) && 1 == put(&c, 1)) {
+        count++;
+    }
+
+    return count;
+}
+
+http_status HTTP_Client::flush()
+{
+    return drain(false) ? http_status::OKAY : http_status::FAIL_HARDWARE;
+}
+
+size_t HTTP_Client::put(const void* buf, size_t n)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+
+    if (chunking()) {
+        return putChunked(bytes, n);
+    }
+
+    if (n >= _txBuffer.capacity()) {
+        // Too big to gain anything from buffering; it goes to the transport
+        // as soon as what's buffered ahead of it has
+        return send() ? sendWire(bytes, n, LAST_CHUNK_SIZE) : 0;
+    }
+
+    size_t count = 0;
+    while (count < n) {
+        size_t k = txFree(LAST_CHUNK_SIZE);
+        count += _txBuffer.write(bytes + count, k < n - count ? k : n - count);
+        if (count == n) {
+            break;
+        }
+
+        // Full; carry on for as long as sending makes room
+        size_t before = _txBuffer.available();
+        if (!send() || _txBuffer.available() == before) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+/*
+ * A write to a chunked body. Small writes collect in the open chunk, which
+ * is framed when it fills up or is drained; big ones are a chunk each. While
+ * the transport is backed up, writes are framed straight into the buffer
+ * behind what it's holding, as far as they fit.
+ */
+size_t HTTP_Client::putChunked(const uint8_t* bytes, size_t n)
+{
+    // The most an open chunk holds, leaving room to frame it and end the body
+    const size_t open = _txBuffer.capacity() - CHUNK_OVERHEAD;
+
+    size_t count = 0;
+    while (count < n) {
+        size_t left = n - count;
+
+        if (0 < _chunkOwed) {
+            // The rest of a chunk whose header has gone, keeping room for
+            // its CRLF and the last chunk
+            size_t k = left < _chunkOwed ? left : _chunkOwed;
+            size_t taken = sendWire(bytes + count, k, 2 + LAST_CHUNK_SIZE);
+            count += taken;
+            _chunkOwed -= taken;
+            if (0 == _chunkOwed) {
+                sendWire("\r\n", 2, LAST_CHUNK_SIZE);
+            }
+            if (taken < k) {
+                break;
+            }
+        } else if (!_chunkOpen && 0 < _txBuffer.available()) {
+            if (!send()) {
+                break;
+            } else if (0 == _txBuffer.available()) {
+                continue;
+            }
+
+            size_t k = txFree(CHUNK_OVERHEAD);
+            if (0 == k) {
+                break;
+            } else if (k > left) {
+                k = left;
+            }
+
+            char header[CHUNK_HEADER_SIZE];
+            _txBuffer.write(header, chunkHeader(header, k));
+            _txBuffer.write(bytes + count, k);
+            _txBuffer.write("\r\n", 2);
+            count += k;
+        } else if (!_chunkOpen && left > open) {
+            // Too big to gain anything from buffering; a chunk of its own,
+            // in pieces the transport's 16-bit lengths can take
+            size_t piece = left > UINT16_MAX ? UINT16_MAX : left;
+            size_t taken = putChunk(bytes + count, piece);
+            count += taken;
+            if (taken < piece) {
+                break;
+            }
+        } else {
+            size_t k = open - _txBuffer.available();
+            if (k > left) {
+                k = left;
+            }
+            _txBuffer.write(bytes + count, k);
+            _chunkOpen = true;
+            count += k;
+
+            if (count < n && !drain(false)) {
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+// One chunk of n bytes, with nothing buffered ahead of it; the bytes taken
+size_t HTTP_Client::putChunk(const uint8_t* bytes, size_t n)
+{
+    char header[CHUNK_HEADER_SIZE];
+    size_t len = chunkHeader(header, n);
+    if (len != sendWire(header, len, 0)) {
+        return 0;
+    }
+
+    // Whatever isn't taken now is owed by the application's next writes
+    _chunkOwed = n;
+    size_t taken = sendWire(bytes, n, 2 + LAST_CHUNK_SIZE);
+    _chunkOwed -= taken;
+    if (0 == _chunkOwed) {
+        sendWire("\r\n", 2, LAST_CHUNK_SIZE);
+    }
+    return taken;
+}
+
+/*
+ * Bytes ready for the wire: to the transport if nothing is buffered ahead
+ * of them, and whatever it doesn't take into the buffer, as far as that
+ * leaves reserve bytes free. The bytes taken, which is short only when the
+ * buffer is full or the connection failed.
+ */
+size_t HTTP_Client::sendWire(const void* buf, size_t n, size_t reserve)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(buf);
+    size_t count = 0;
+
+    if (0 == _txBuffer.available()) {
+        while (count < n) {
+            size_t piece = n - count > UINT16_MAX ? UINT16_MAX : n - count;
+            size_t written = _client.write(bytes + count, piece);
+            _flushes++;
+            count += written;
+            if (written != piece) {
+                _txBlocked = true;
+                break;
+            }
+        }
+
+        if (count == n || !_client.connected()) {
+            return count;
+        }
+    }
+
+    size_t k = txFree(reserve);
+    return count + _txBuffer.write(bytes + count, k < n - count ? k : n - count);
+}
+
+/*
+ * Hands the transport whatever is buffered for the wire, as much as it will
+ * take. False if the connection has failed.
+ */
+bool HTTP_Client::send()
+{
+    if (_chunkOpen) {
+        // Nothing framed for the wire yet, see drain()
+        _txBlocked = false;
+        return true;
+    }
+
+    if (0 < _txBuffer.available()) {
+        _flushes++;
+        _txBuffer.writeTo(_client);
+    }
+
+    _txBlocked = 0 < _txBuffer.available();
+    return !_txBlocked || _client.connected();
+}
+
+/*
+ * Sends what has been written, framing the open chunk of a chunked body
+ * first and, with last, ending the body. Whatever the transport can't take
+ * yet stays buffered; false only if the connection has failed, or the body
+ * can't be ended because the application stopped partway through a chunk.
+ */
+bool HTTP_Client::drain(bool last)
+{
+    if (!chunking()) {
+        return send();
+    }
+
+    if (last && 0 < _chunkOwed) {
+        return false;
+    }
+
+    if (!_chunkOpen) {
+        if (!send()) {
+            return false;
+        }
+        return !last || LAST_CHUNK_SIZE
+            == sendWire("0\r\n\r\n", LAST_CHUNK_SIZE, 0);
+    }
+
+    // Frame the open chunk, so it goes out in one write
+    uint8_t frame[HTTP_TX_BUFFER_SIZE + CHUNK_OVERHEAD];
+    size_t n = _txBuffer.available();
+    size_t len = chunkHeader(reinterpret_cast<char*>(frame), n);
+    while (0 < _txBuffer.available()) {
+        len += _txBuffer.read(frame + len, n);
+    }
+    frame[len++] = '\r';
+    frame[len++] = '\n';
+    _chunkOpen = false;
+
+    if (last) {
+        // Last chunk, with no trailers
+        memcpy(frame + len, "0\r\n\r\n", LAST_CHUNK_SIZE);
+        len += LAST_CHUNK_SIZE;
+    }
+
+    return len == sendWire(frame, len, 0);
+}
+
+// Room in the transmit buffer, less reserve
+size_t HTTP_Client::txFree(size_t reserve) const
+{
+    size_t unused = _txBuffer.capacity() - _txBuffer.available();
+    return unused > reserve ? unused - reserve : 0;
+}
+
+// The body bytes put() is sure to take right now
+size_t HTTP_Client::room() const
+{
+    if (!chunking()) {
+        return txFree(LAST_CHUNK_SIZE);
+    } else if (0 < _chunkOwed) {
+        size_t k = txFree(2 + LAST_CHUNK_SIZE);
+        return k < _chunkOwed ? k : _chunkOwed;
+    } else if (_chunkOpen || 0 == _txBuffer.available()) {
+        return _txBuffer.capacity() - CHUNK_OVERHEAD - _txBuffer.available();
+    }
+    return txFree(CHUNK_OVERHEAD);
+}
+
+bool HTTP_Client::chunking() const
+{
+    return _chunkedResponse && http_response_state::BODY == _responseState;
+}
+
+size_t HTTP_Client::chunkHeader(char* dest, size_t n)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    // Every nibble of n, without leading zeros
+    size_t len = 0;
+    for (size_t shift = 8 * sizeof(size_t); shift > 0; shift -= 4) {
+        uint8_t digit = (n >> (shift - 4)) & 0xf;
+        if (0 < len || 0 != digit || 4 == shift) {
+            dest[len++] = digits[digit];
+        }
+    }
+
+    dest[len++] = '\r';
+    dest[len++] = '\n';
+    return len;
+}
+
+// Digits of v in base, without leading zeros; dest needs 8 * sizeof(v)
+static size_t formatNumber(char* dest, HTTP_LENGTH_TYPE v, uint8_t base)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char reversed[8 * sizeof(v)];
+    size_t len = 0;
+    do {
+        reversed[len++] = digits[v % base];
+        v /= base;
+    } while (0 != v);
+
+    for (size_t ii = 0; ii < len; ii++) {
+        dest[ii] = reversed[len - ii - 1];
+    }
+    return len;
+}
+
+// Whether the If-None-Match list takes in the tag, by weak comparison
+bool HTTP_Client::ifNoneMatch(const char* opaque, size_t n) const
+{
+    if (!_hasIfNoneMatch) {
+        return false;
+    } else if (_ifNoneMatchAny) {
+        return true;
+    }
+
+    uint32_t h = fnv1a(FNV_OFFSET, reinterpret_cast<const uint8_t*>(opaque), n);
+    for (size_t ii = 0; ii < _ifNoneMatchCount; ii++) {
+        if (h == _ifNoneMatch[ii]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HTTP_Client::fileHeaders(bool sized, HTTP_LENGTH_TYPE size, uint32_t tag)
+{
+    /*
+     * A weak ETag from the size and the file's tag, both in hex. The tag
+     * comes from a modification time, or a hash, neither of which promises
+     * the bytes are the same, so it's only fit for weak comparison.
+     */
+    char etag[8 * sizeof(HTTP_LENGTH_TYPE) + 8 * sizeof(uint32_t) + 6];
+    size_t len = 0;
+    etag[len++] = 'W';
+    etag[len++] = '/';
+    etag[len++] = '"';
+    len += formatNumber(etag + len, size, 16);
+    etag[len++] = '-';
+    len += formatNumber(etag + len, tag, 16);
+    etag[len++] = '"';
+    etag[len] = '\0';
+
+    bool cached = ifNoneMatch(etag + 3, len - 4);
+
+    // Nothing can follow headers that were cut short
+    if (3 != write(cached ? F("304") : F("200"))
+            || !writePart(http_response_state::STATUS_REASON,
+                          cached ? F("Not Modified") : F("OK"))
+            || !writePart(http_response_state::HEADER_NAME, F("ETag"))
+            || !writePart(http_response_state::HEADER_VALUE, etag)) {
+        close();
+        return false;
+    } else if (cached) {
+        return false;
+    }
+
+    bool head = http_method::HEAD == _method;
+    if (sized) {
+        char digits[8 * sizeof(HTTP_LENGTH_TYPE) + 1];
+        digits[formatNumber(digits, size, 10)] = '\0';
+
+        if (!writePart(http_response_state::HEADER_NAME, F("Content-Length"))
+                || !writePart(http_response_state::HEADER_VALUE, digits)) {
+            close();
+            return false;
+        }
+    } else if (!head) {
+        chunked();
+    }
+
+    return !head;
+}
+
+// Moves the response on to state and writes str; whether all of it went
+bool HTTP_Client::writePart(http_response_state state,
+                            const __FlashStringHelper* str)
+{
+    return http_status::OKAY == advanceTo(state)
+        && strlen_P(reinterpret_cast<const char*>(str)) == write(str);
+}
+
+bool HTTP_Client::writePart(http_response_state state, const char* str)
+{
+    return http_status::OKAY == advanceTo(state) && strlen(str) == write(str);
+}
+
+http_status HTTP_Client::chunked()
+{
+    if (http_response_state::BODY == _responseState) {
+        error("body already started");
+        return http_status::FAIL_INVALID_STATE;
+    }
+
+    _chunkedResponse = http_version::HTTP_1_1 == _version;
+    if (!_chunkedResponse) {
+        _keepAlive = false; // Only closing the connection can end the body
+    }
+    return http_status::OKAY;
 }
 
 bool HTTP_Client::isValidResponseTransition(http_response_state state)
@@ -496,30 +1451,52 @@ http_status HTTP_Client::advanceTo(http_response_state state)
 
     static const __FlashStringHelper* const eol = F("\r\n");
     static const __FlashStringHelper* const eoh = F(": ");
+    static const __FlashStringHelper* const space = F(" ");
     static const __FlashStringHelper* const body = F("\r\n\r\n");
+    static const __FlashStringHelper* const te
+        = F("\r\nTransfer-Encoding: chunked\r\n\r\n");
 
-    http_status status;
+    const __FlashStringHelper* separator;
     switch (state) {
         case http_response_state::HEADER_VALUE:
-            status = 2 == write(eoh) ? http_status::OKAY : http_status::FAIL_HARDWARE;
+            separator = eoh;
             break;
         case http_response_state::STATUS_REASON:
         case http_response_state::STATUS_CODE:
-            status = write(' ');
+            separator = space;
             break;
         case http_response_state::BODY:
-            status = 4 == write(body) ? http_status::OKAY : http_status::FAIL_HARDWARE;
+            separator = _chunkedResponse ? te : body;
             break;
         case http_response_state::HEADER_NAME:
-            status = 2 == write(eol) ? http_status::OKAY : http_status::FAIL_HARDWARE;
+            separator = eol;
             break;
         default:
-            status = http_status::OKAY;
+            separator = NULL;
             break;
     }
 
-    if (http_status::OKAY != status) {
-        return status;
+    if (NULL != separator) {
+        // The separator goes whole or not at all, so a retry can't repeat
+        // part of it
+        size_t len = strlen_P(reinterpret_cast<const char*>(separator));
+        if (txFree(LAST_CHUNK_SIZE) < len) {
+            if (!send()) {
+                return http_status::FAIL_HARDWARE;
+            } else if (txFree(LAST_CHUNK_SIZE) < len) {
+                resume();
+                return http_status::INCOMPLETE;
+            }
+        }
+
+        if (len != write(separator)) {
+            return http_status::FAIL_HARDWARE;
+        }
+    }
+
+    // Send the headers now; a chunked body is framed from here on
+    if (http_response_state::BODY == state && !drain(false)) {
+        return http_status::FAIL_HARDWARE;
     }
 
     _responseState = state;
@@ -529,16 +1506,53 @@ http_status HTTP_Client::advanceTo(http_response_state state)
 
 http_status HTTP_Client::close()
 {
+    if (_closed) {
+        return http_status::OKAY;
+    }
+    _closed = true;
+
+    // A response complete() finished has already been ended
+    if (!_finishing) {
+        drain(true);
+    }
+
+    // See HTTP_Server::linger()
     debug("closing connection...");
-    delay(100);
-    _client.close();
-    debug("closed.");
+    return http_status::OKAY;
+}
+
+http_status HTTP_Client::complete()
+{
+    if (_finishing) {
+        return http_status::OKAY;
+    }
+
+    // Without the whole request, there's no telling where the next one starts
+    if (!_keepAlive || http_request_state::DONE != _requestState
+            || http_response_state::BODY != _responseState) {
+        return close();
+    }
+
+    if (!drain(true)) {
+        close();
+        return http_status::FAIL_HARDWARE;
+    }
+
+    debug("keeping connection alive");
+    if (_txBlocked) {
+        // Pipelined requests are answered in order, so the next one waits
+        // for this response to go; see HTTP_Server::writable()
+        _finishing = true;
+    } else {
+        reset();
+    }
     return http_status::OKAY;
 }
 
 /*****************************************************************************
  * HTTP_Server Implementation                                                *
  *****************************************************************************/
+#ifdef ARDUINO
 HTTP_Server::HTTP_Server(uint8_t cs, uint8_t irq, uint8_t vbat,
         uint8_t spi_div, uint16_t port)
     : _cc3000(cs, irq, vbat, spi_div), _server(port)
@@ -587,53 +1601,448 @@ http_status HTTP_Server::connect(const char* ssid, const char* key,
 
     return http_status::OKAY;
 }
+#else
+HTTP_Server::HTTP_Server(uint16_t port)
+    : _server(port)
+{
+}
+
+http_status HTTP_Server::begin()
+{
+    debug("Listening...");
+    if (!_server.begin()) {
+        error("Couldn't listen on port");
+        return http_status::FAIL_HARDWARE;
+    }
+
+    return http_status::OKAY;
+}
+#endif /* ARDUINO */
 
-http_status HTTP_Server::tick()
+void HTTP_Server::schedule(size_t idx)
 {
-    /* Find disconnected clients */
-    for (size_t ii = 0; ii < MAX_SERVER_CLIENTS; ii++) {
-        HTTP_Client& httpClient = client(ii);
-        Adafruit_CC3000_ClientRef ccClient = _server.getClientRef(ii);
-        if (httpClient.connected() && !ccClient.connected()) {
-            Serial.print(F("Disconnected - Client "));
-            Serial.println(ii, DEC);
-            httpClient.disconnect();
-        }
+    HTTP_Client& httpClient = client(idx);
+    if (!httpClient._queued) {
+        httpClient._queued = true;
+        httpClient._readySince = micros();
+        _ready[(_readyStart + _readyCount) % HTTP_MAX_CLIENTS] = idx;
+        _readyCount++;
     }
+}
+
+http_status HTTP_Server::tick()
+{
+    TransportEvent events[HTTP_EVENTS_PER_TICK];
+
+    // Only wait for the network when no client has work left over
+    size_t n = _server.poll(events, HTTP_EVENTS_PER_TICK,
+                            _readyCount ? 0 : pollTimeout());
+    unsigned long now = clockMillis();
 
-    /* Accept new clients */
-    bool newClient = false;
-    int8_t idx = _server.availableIndex(&newClient);
+    for (size_t ii = 0; ii < n; ii++) {
+        size_t idx = events[ii].index;
+        HTTP_Client& httpClient = client(idx);
 
-    /* Update connected clients */
-    if (newClient) {
-        for (size_t ii = 0; ii < MAX_SERVER_CLIENTS; ii++) {
-            HTTP_Client& httpClient = client(ii);
-            Adafruit_CC3000_ClientRef ccClient = _server.getClientRef(ii);
-            if (!httpClient.connected() && ccClient.connected()) {
+        switch (events[ii].type) {
+            case transport_event::CONNECTED:
+#ifndef HTTP_SILENT
                 Serial.print(F("Connected - Client "));
-                Serial.println(ii, DEC);
+                Serial.println(idx, DEC);
+#endif
+                unwait(idx);
+                reclaim(httpClient);
+                httpClient.client(_server.getClientRef(idx));
                 httpClient.connect();
-            }
+                arm(idx, now);
+                break;
+            case transport_event::DISCONNECTED:
+#ifndef HTTP_SILENT
+                Serial.print(F("Disconnected - Client "));
+                Serial.println(idx, DEC);
+#endif
+                httpClient.disconnect();
+                unwait(idx);
+                reclaim(httpClient);
+                _timers.cancel(idx);
+                break;
+            case transport_event::READABLE:
+                if (!httpClient.connected()) {
+                    break;
+                } else if (httpClient._txBlocked && !httpClient._closed) {
+                    // The input waits for the output ahead of it to go,
+                    // see writable()
+                    _server.suspendReads(idx);
+                    break;
+                } else if (!lend(httpClient)) {
+                    // Leave the input where it is until there's a buffer
+                    // to read it into
+                    wait(idx);
+                    break;
+                }
+
+                {
+                    HTTP_TransportClient ccClient = _server.getClientRef(idx);
+                    httpClient._received += httpClient._buffer.readFrom(ccClient);
+                }
+
+                if (httpClient._closed) {
+                    // Nobody is going to read it, so throw it away
+                    reclaim(httpClient);
+                    break;
+                }
+                schedule(idx);
+                break;
+            case transport_event::WRITABLE:
+                if (httpClient.connected()) {
+                    writable(idx, now);
+                }
+                break;
         }
     }
 
-    /* Handle new data */
-    if (idx >= 0) {
-        Adafruit_CC3000_ClientRef ccClient = _server.getClientRef(idx);
+    // Clients out of time get one more process(), to see read() fail
+    for (size_t idx; HTTP_MAX_CLIENTS != (idx = _timers.expire(now));) {
+        if (http_timer::CLOSING == client(idx)._timer) {
+            // The peer had its chance to finish
+            _server.getClientRef(idx).close();
+        } else if (http_timer::SENDING == client(idx)._timer) {
+            // It stopped taking the response, so nothing more can reach it
+            _evictions++;
+            _server.getClientRef(idx).close();
+        } else if (expired(idx, now)) {
+            HTTP_Client& httpClient = client(idx);
+            httpClient._timedOut = true;
+            httpClient._timer = http_timer::NONE;
+            _evictions++;
+            schedule(idx);
+        }
+    }
+
+    /*
+     * Process the clients that were ready when this pass started. Anything
+     * that still has work afterwards goes to the back of the queue.
+     */
+    for (size_t count = _readyCount; count > 0; count--) {
+        size_t idx = _ready[_readyStart];
+        _readyStart = (_readyStart + 1) % HTTP_MAX_CLIENTS;
+        _readyCount--;
+
         HTTP_Client& httpClient = client(idx);
+        httpClient._queued = false;
 
-        httpClient._buffer.readFrom(ccClient);
-    }
+        if (!httpClient.connected() || httpClient._closed
+                || httpClient._txBlocked) {
+            continue;
+        }
+
+        httpClient.client(_server.getClientRef(idx));
+        turn(httpClient);
+
+        if (!httpClient.connected()) {
+            reclaim(httpClient);
+            continue;
+        } else if (httpClient._closed) {
+            linger(idx, now);
+            continue;
+        }
+
+        arm(idx, now);
+        if (httpClient._txBlocked) {
+            // Any input left keeps until the connection takes the output,
+            // so the next response can't be written into a full buffer
+            if (!httpClient._buffer.available()) {
+                reclaim(httpClient);
+            }
+            _server.notifyWritable(idx);
+            continue;
+        } else if (httpClient._buffer.available()) {
+            schedule(idx);
+            continue;
+        }
 
-    /* Process any data in client buffers */
-    for (size_t ii = 0; ii < MAX_SERVER_CLIENTS; ii++) {
-        HTTP_Client& httpClient = client(ii);
-        if (httpClient.connected()) {
-            httpClient.client(_server.getClientRef(ii));
-            httpClient.process();
+        // Caught up with the input, so let another client have the buffer
+        reclaim(httpClient);
+        if (httpClient._resume) {
+            _server.notifyWritable(idx);
         }
     }
 
     return http_status::OKAY;
 }
+
+/*
+ * Gives the client its share of the tick: process() until it stops making
+ * headway on its input, runs through its budget, or backs up its output. If
+ * it still has input after that, tick() puts it at the back of the queue.
+ */
+void HTTP_Server::turn(HTTP_Client& httpClient)
+{
+    unsigned long start = micros();
+    unsigned long wait = start - httpClient._readySince;
+
+    _stats.turns++;
+    _stats.totalWait += wait;
+    if (wait > _stats.maxWait) {
+        _stats.maxWait = wait;
+    }
+
+    httpClient._resume = false;
+
+    for (size_t used = 0;;) {
+        size_t before = httpClient._buffer.available();
+
+        _stats.calls++;
+        httpClient.process();
+
+        if (httpClient._timedOut) {
+            httpClient.close();
+        }
+
+        if (!httpClient.connected() || httpClient._closed
+                || httpClient._txBlocked) {
+            return;
+        }
+
+        size_t after = httpClient._buffer.available();
+        if (0 == after || after >= before) {
+            return;     // Caught up, or waiting on something else
+        }
+
+        used += before - after;
+        if (used >= _budget.bytes || (_budget.micros
+                && micros() - start >= _budget.micros)) {
+            _stats.preempted++;
+            return;
+        }
+    }
+}
+
+// Makes sure the client has a receive buffer, if one can be had
+bool HTTP_Server::lend(HTTP_Client& httpClient)
+{
+    if (httpClient._buffer.attached()) {
+        return true;
+    }
+
+    uint8_t* block = _pool.acquire();
+    if (NULL == block) {
+        return false;
+    }
+
+    httpClient._buffer.attach(block);
+    return true;
+}
+
+/*
+ * Takes back the client's receive buffer, if it has one, and lends it to
+ * the client that has waited longest for one.
+ */
+void HTTP_Server::reclaim(HTTP_Client& httpClient)
+{
+    if (!httpClient._buffer.attached()) {
+        return;
+    }
+    _pool.release(httpClient._buffer.detach());
+
+    while (0 < _waitCount) {
+        size_t idx = _waiters[_waitStart];
+        _waitStart = (_waitStart + 1) % HTTP_MAX_CLIENTS;
+        _waitCount--;
+
+        HTTP_Client& waiter = client(idx);
+        waiter._waiting = false;
+        _server.resumeReads(idx);
+
+        // Its input is reported again, and read into the buffer then; unless
+        // its output is backed up, when it would only sit there
+        if (!waiter._buffer.attached() && !waiter._txBlocked
+                && lend(waiter)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Queues a client whose input arrived with no buffer free. Its reads are
+ * suspended meanwhile; the transport would otherwise report the same input
+ * on every poll, and the server would spin on it.
+ */
+void HTTP_Server::wait(size_t idx)
+{
+    HTTP_Client& httpClient = client(idx);
+    _bufferWaits++;
+    _server.suspendReads(idx);
+
+    if (!httpClient._waiting) {
+        httpClient._waiting = true;
+        _waiters[(_waitStart + _waitCount) % HTTP_MAX_CLIENTS] = idx;
+        _waitCount++;
+    }
+}
+
+// Takes a client out of the queue for buffers, when it's gone
+void HTTP_Server::unwait(size_t idx)
+{
+    HTTP_Client& httpClient = client(idx);
+    if (!httpClient._waiting) {
+        return;
+    }
+    httpClient._waiting = false;
+
+    size_t kept = 0;
+    for (size_t ii = 0; ii < _waitCount; ii++) {
+        size_t other = _waiters[(_waitStart + ii) % HTTP_MAX_CLIENTS];
+        if (other != idx) {
+            _waiters[(_waitStart + kept++) % HTTP_MAX_CLIENTS] = other;
+        }
+    }
+    _waitCount = kept;
+}
+
+unsigned long HTTP_Server::limit(http_timer timer) const
+{
+    switch (timer) {
+        case http_timer::IDLE:
+            return _timeouts.idle;
+        case http_timer::HEADERS:
+            return _timeouts.headers;
+        case http_timer::BODY:
+            return _timeouts.body;
+        case http_timer::SENDING:
+            return _timeouts.send;
+        default:
+            return 0;
+    }
+}
+
+// Starts the limit for where the client's request has got to, if it changed
+void HTTP_Server::arm(size_t idx, unsigned long now)
+{
+    HTTP_Client& httpClient = client(idx);
+    http_timer timer = httpClient.timer();
+    if (timer == httpClient._timer) {
+        return;
+    }
+
+    httpClient._timer = timer;
+    httpClient._received = 0;
+
+    unsigned long ms = limit(timer);
+    if (0 == ms) {
+        _timers.cancel(idx);
+    } else {
+        _timers.schedule(idx, now + ms);
+    }
+}
+
+/*
+ * Whether the client whose time ran out should go. Input that arrived but
+ * hasn't been parsed, because the application or the buffer pool is behind,
+ * counts for the client; so does a body arriving at the minimum rate. Either
+ * way it gets another period. The header limit is never extended, or a
+ * client could dribble headers in forever.
+ */
+bool HTTP_Server::expired(size_t idx, unsigned long now)
+{
+    HTTP_Client& httpClient = client(idx);
+    if (!httpClient.connected() || httpClient._closed) {
+        return false;
+    }
+
+    httpClient.client(_server.getClientRef(idx));
+
+    switch (httpClient._timer) {
+        case http_timer::IDLE:
+            if (!httpClient.pending()) {
+                return true;
+            }
+            break;
+        case http_timer::HEADERS:
+            return true;
+        case http_timer::BODY:
+            if (httpClient._received < _timeouts.bodyMinBytes
+                    && !httpClient.pending()) {
+                return true;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    httpClient._received = 0;
+    _timers.schedule(idx, now + limit(httpClient._timer));
+    return false;
+}
+
+/*
+ * Starts closing a client the application closed. Closing the connection
+ * outright could lose the end of its output: the transmit buffer may still
+ * hold some, the CC3000 drops what it hasn't sent yet, and a TCP stack
+ * resets the connection if input is left unread. So the rest of the output
+ * goes first, as the connection takes it; then the peer is told there's no
+ * more to come, the server reads and throws away anything else it sends,
+ * and the connection is closed once the peer hangs up or time runs out.
+ */
+void HTTP_Server::linger(size_t idx, unsigned long now)
+{
+    HTTP_Client& httpClient = client(idx);
+    reclaim(httpClient);
+
+    if (http_timer::CLOSING == httpClient._timer) {
+        return;
+    }
+    httpClient._timer = http_timer::CLOSING;
+
+    if (0 == _timeouts.close) {
+        _timers.cancel(idx);
+        _server.getClientRef(idx).close();
+        return;
+    }
+
+    _timers.schedule(idx, now + _timeouts.close);
+    if (httpClient._txBuffer.available()) {
+        _server.notifyWritable(idx);    // See writable()
+    } else {
+        _server.shutdown(idx);
+    }
+}
+
+/*
+ * The client's connection can take more output. What it has buffered goes
+ * first, and while that keeps going, its send limit starts over. Once it's
+ * all gone, a closing client is half-closed; any other is ready for its
+ * next request if it had completed one, reads again, and gets its turn if
+ * it asked to resume or has input waiting.
+ */
+void HTTP_Server::writable(size_t idx, unsigned long now)
+{
+    HTTP_Client& httpClient = client(idx);
+    httpClient.client(_server.getClientRef(idx));
+
+    size_t before = httpClient._txBuffer.available();
+    if (!httpClient.send()) {
+        return;     // The transport reports the hangup
+    }
+
+    if (httpClient._txBlocked) {
+        if (httpClient._txBuffer.available() < before && !httpClient._closed
+                && 0 != _timeouts.send) {
+            _timers.schedule(idx, now + _timeouts.send);
+        }
+        _server.notifyWritable(idx);
+    } else if (httpClient._closed) {
+        _server.shutdown(idx);
+    } else {
+        if (httpClient._finishing) {
+            httpClient._finishing = false;
+            httpClient.reset();
+        }
+        if (!httpClient._waiting) {
+            _server.resumeReads(idx);
+        }
+        arm(idx, now);
+        if (httpClient._resume || httpClient._buffer.available()) {
+            schedule(idx);
+        }
+    }
+}
@@ -1,21 +1,144 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
-#include <Adafruit_CC3000.h>
+#include "Platform.h"
 #include "RingBuffer.h"
+#include "BufferPool.h"
+#include "TimerWheel.h"
 #include "StringComparator.h"
 #include "IntParser.h"
 
+/*
+ * The transport provides HTTP_TransportServer and HTTP_TransportClient, with
+ * the same interface as Adafruit_CC3000_Server and Adafruit_CC3000_ClientRef.
+ */
+#ifdef ARDUINO
+#   include "CC3000Transport.h"
+#else
+#   include "PosixTransport.h"
+#endif
+
+#define HTTP_MAX_CLIENTS HTTP_TRANSPORT_MAX_CLIENTS
+
+// Most transport events handled per tick
+#ifndef HTTP_EVENTS_PER_TICK
+#   define HTTP_EVENTS_PER_TICK HTTP_TRANSPORT_EVENTS
+#endif
+
+/*
+ * Receive buffer per client. Requests stream through it, so it can be much
+ * smaller than the longest line; the parser only needs room to look one
+ * byte past a '\r' or ':' it has read.
+ */
 #ifndef HTTP_BUFFER_SIZE
-#   define HTTP_BUFFER_SIZE RXBUFFERSIZE
-#elif HTTP_BUFFER_SIZE < RXBUFFERSIZE
-    /*
-     * Don't really know why it glitches with < RXBUFFERSIZE, should look into
-     * it eventually.
-     */
-#   error "HTTP_BUFFER_SIZE must be greater than or equal to RXBUFFERSIZE"
+#   define HTTP_BUFFER_SIZE HTTP_TRANSPORT_RXBUFFERSIZE
+#elif HTTP_BUFFER_SIZE < 2
+#   error "HTTP_BUFFER_SIZE must be at least 2"
 #endif /* HTTP_BUFFER_SIZE */
 
+/*
+ * Receive buffers are lent to clients from a pool of this many, and only
+ * while they have input that hasn't been parsed. When they're all out, the
+ * server stops reading from the clients left waiting, and the network
+ * holds their input back until a buffer comes free.
+ */
+#ifndef HTTP_BUFFER_POOL_SIZE
+#   define HTTP_BUFFER_POOL_SIZE HTTP_TRANSPORT_BUFFERS
+#endif
+
+/*
+ * Response writes are collected in a buffer of this size and handed to the
+ * transport together: when it fills up, when the body starts, and on close().
+ * Output the transport can't take yet waits here too, until the connection
+ * is writable again; writes come back short while it's full.
+ */
+#ifndef HTTP_TX_BUFFER_SIZE
+#   define HTTP_TX_BUFFER_SIZE HTTP_TRANSPORT_TXBUFFERSIZE
+#endif
+
+/*
+ * The type of Content-Length and chunk sizes. Wider types accept bigger
+ * bodies, but cost more per digit on 8-bit processors.
+ */
+#ifndef HTTP_LENGTH_TYPE
+#   ifdef ARDUINO
+#       define HTTP_LENGTH_TYPE uint32_t
+#   else
+#       define HTTP_LENGTH_TYPE uintmax_t
+#   endif
+#endif
+
+/*
+ * Milliseconds a connection may sit without a request, a request may take
+ * to get through its headers, and a body may take to deliver each
+ * HTTP_BODY_MIN_BYTES. A client that misses one is closed, so a few slow
+ * ones can't hold on to every slot. 0 turns a limit off. These are the
+ * defaults; see HTTP_Server::timeouts().
+ */
+#ifndef HTTP_IDLE_TIMEOUT
+#   define HTTP_IDLE_TIMEOUT 5000
+#endif
+
+#ifndef HTTP_HEADER_TIMEOUT
+#   define HTTP_HEADER_TIMEOUT 10000
+#endif
+
+#ifndef HTTP_BODY_TIMEOUT
+#   define HTTP_BODY_TIMEOUT 5000
+#endif
+
+#ifndef HTTP_BODY_MIN_BYTES
+#   define HTTP_BODY_MIN_BYTES 64
+#endif
+
+/*
+ * Milliseconds output may sit in the transmit buffer without the peer taking
+ * any of it, before the connection is dropped.
+ */
+#ifndef HTTP_SEND_TIMEOUT
+#   define HTTP_SEND_TIMEOUT 5000
+#endif
+
+/*
+ * Milliseconds a closed connection is kept for the peer to take the rest of
+ * the response and hang up, before it's dropped regardless.
+ */
+#ifndef HTTP_CLOSE_TIMEOUT
+#   define HTTP_CLOSE_TIMEOUT HTTP_TRANSPORT_CLOSE_TIMEOUT
+#endif
+
+/*
+ * The most input one client may work through in a turn, and the longest its
+ * turn may last in microseconds. Within those, process() is called again for
+ * as long as it keeps consuming input, until the buffer is empty; then the
+ * next client gets a turn. A budget of 0 bytes means one process() a turn,
+ * and 0 microseconds means no time limit. See HTTP_Server::budget().
+ */
+#ifndef HTTP_TURN_BYTES
+#   define HTTP_TURN_BYTES HTTP_BUFFER_SIZE
+#endif
+
+#ifndef HTTP_TURN_MICROS
+#   define HTTP_TURN_MICROS 2000
+#endif
+
+/*
+ * Entity tags kept from a request's If-None-Match list, 4 bytes each. Tags
+ * past these are dropped, which can only turn a 304 into a full response.
+ */
+#ifndef HTTP_IF_NONE_MATCH_TAGS
+#   define HTTP_IF_NONE_MATCH_TAGS 4
+#endif
+
+// Milliseconds per slot of the timer wheel, and how many slots it has
+#ifndef HTTP_TIMER_RESOLUTION
+#   define HTTP_TIMER_RESOLUTION 64
+#endif
+
+#ifndef HTTP_TIMER_SLOTS
+#   define HTTP_TIMER_SLOTS 16
+#endif
+
 enum class http_status
 {
 	OKAY,
@@ -29,6 +152,7 @@ enum class http_status
     FAIL_INVALID_ARG,
     FAIL_BAD_REQUEST,
     FAIL_UNSUPPORTED,
+    FAIL_METHOD_NOT_ALLOWED,
 };
 
 enum class http_request_state
@@ -43,6 +167,69 @@ enum class http_request_state
     DONE,
 };
 
+// Position within a chunked request body, see HTTP_Client::readChunked
+enum class http_chunk_state
+{
+    SIZE,           // First hex digit of the chunk size
+    SIZE_DIGITS,    // Remaining hex digits of the chunk size
+    EXTENSION,      // Chunk extensions (ignored) up to the end of the line
+    DATA,           // Chunk data
+    DATA_END,       // CRLF after the chunk data
+    TRAILER,        // Start of a trailer line, or the final empty line
+    TRAILER_LINE,   // Rest of a trailer line (ignored)
+};
+
+// Position within an If-None-Match list, see HTTP_Client::readIfNoneMatch
+enum class http_etag_state
+{
+    BETWEEN,        // Before a tag, or at the whitespace and commas after one
+    WEAK,           // After the 'W' of a "W/" prefix
+    OPEN,           // Expecting the opening quote
+    TAG,            // Inside the quotes
+    SKIP,           // In something that isn't a tag, up to the next comma
+};
+
+// The limit a connection is held to, by how far its request has got
+enum class http_timer
+{
+    NONE,       // Responding, or the request has been read
+    IDLE,       // Waiting for the next request
+    HEADERS,    // Reading the request line and headers
+    BODY,       // Reading a body that hasn't all arrived
+    SENDING,    // Waiting for the peer to take buffered output
+    CLOSING,    // Closed, waiting for the peer to finish
+};
+
+struct HTTP_Timeouts
+{
+    unsigned long idle = HTTP_IDLE_TIMEOUT;
+    unsigned long headers = HTTP_HEADER_TIMEOUT;
+    unsigned long body = HTTP_BODY_TIMEOUT;
+    unsigned long bodyMinBytes = HTTP_BODY_MIN_BYTES;
+    unsigned long send = HTTP_SEND_TIMEOUT;
+    unsigned long close = HTTP_CLOSE_TIMEOUT;
+};
+
+struct HTTP_Budget
+{
+    size_t bytes = HTTP_TURN_BYTES;
+    unsigned long micros = HTTP_TURN_MICROS;
+};
+
+/*
+ * How the clients with work have been shared out: how long each waited in
+ * the queue for its turn, in microseconds, and how often a turn ran out of
+ * budget. A maxWait far above the average means someone is being starved.
+ */
+struct HTTP_SchedulerStats
+{
+    unsigned long turns = 0;
+    unsigned long calls = 0;        // To process(); more than turns if looping
+    unsigned long preempted = 0;    // Turns the budget cut short
+    unsigned long totalWait = 0;
+    unsigned long maxWait = 0;
+};
+
 enum class http_response_state
 {
     VERSION,
@@ -60,13 +247,127 @@ enum class http_version
     HTTP_1_1,
 };
 
+// In the order of HTTP_METHODS in HTTP_Server.cpp
+enum class http_method
+{
+    UNKNOWN,
+    GET,
+    HEAD,
+    POST,
+    PUT,
+    DELETE,
+    OPTIONS,
+    PATCH,
+    TRACE,
+    CONNECT,
+};
+
+// A set of methods, such as those allowed on a route
+typedef uint16_t http_methods;
+#define HTTP_ANY_METHOD UINT16_MAX
+
+constexpr http_methods HTTPMethodBit(http_method m)
+{
+    return static_cast<http_methods>(1u << static_cast<unsigned>(m));
+}
+
 enum class http_header
 {
     UNKNOWN,
     TRANSFER_ENCODING,
     CONTENT_LENGTH,
+    CONNECTION,
+    IF_NONE_MATCH,
+    SUBSCRIBED,         // One the application asked for, see HTTP_HeaderTable
+};
+
+// Names of the headers the server acts on itself, in http_header order
+#define HTTP_BUILTIN_HEADERS "Transfer-Encoding", "Content-Length", \
+                                "Connection", "If-None-Match"
+#define HTTP_BUILTIN_HEADER_COUNT 4
+
+// How the value of a subscribed header is handed to HTTP_Client::header()
+enum class http_header_kind
+{
+    SPAN,       // The bytes as they are, in as many pieces as they arrive in
+    INTEGER,    // A decimal number
+    TOKEN,      // One of a fixed set of strings
+};
+
+struct HTTP_HeaderSpec
+{
+    http_header_kind kind;
+    const StringComparator* tokens;     // The strings a TOKEN is matched to
 };
 
+// The value of a subscribed header, or for a SPAN, the next piece of it
+struct http_header_event
+{
+    size_t header;              // Index into the application's header names
+    http_header_kind kind;
+    bool valid;                 // The INTEGER parsed, or the TOKEN matched
+    bool last;                  // No more pieces of this value will follow
+    HTTP_LENGTH_TYPE integer;
+    size_t token;               // Index of the matching string
+    const uint8_t* data;        // A piece of a SPAN, only valid for the call
+    size_t length;
+};
+
+template<const char* const* S, typename L>
+struct HTTP_HeaderNames;
+
+// The built-in header names followed by those at S, to be matched together
+template<const char* const* S, size_t... I>
+struct HTTP_HeaderNames<S, index_list<I...> >
+{
+    static constexpr const char* const names[] = {HTTP_BUILTIN_HEADERS, S[I]...};
+};
+
+template<const char* const* S, size_t... I>
+constexpr const char* const HTTP_HeaderNames<S, index_list<I...> >::names[];
+
+/*
+ * The headers an application wants to hear about. Their names go into the
+ * same case-insensitive DFA as the built-in ones, so each header name is
+ * still scanned once:
+ *
+ *     constexpr const char* const NAMES[] = {"Host", "Content-Type"};
+ *     static const HTTP_HeaderSpec SPECS[] = {
+ *         {http_header_kind::SPAN, NULL},
+ *         {http_header_kind::TOKEN, &contentTypes},
+ *     };
+ *     static HTTP_HeaderTable headers = HTTP_HEADER_TABLE(NAMES, SPECS);
+ *
+ * Built-in headers are always handled by the server, even if listed.
+ */
+class HTTP_HeaderTable
+{
+    friend class HTTP_Client;
+private:
+    StringComparator _names;
+    const HTTP_HeaderSpec* _specs;
+    size_t _count;
+
+public:
+    HTTP_HeaderTable(const StringComparator& names,
+                        const HTTP_HeaderSpec* specs, size_t count)
+        : _names(names), _specs(specs), _count(count) {}
+
+    template<const char* const* S, size_t N, size_t M>
+    static HTTP_HeaderTable create(const HTTP_HeaderSpec (&specs)[M]) {
+        static_assert(N == M, "need one HTTP_HeaderSpec per header name");
+
+        typedef HTTP_HeaderNames<S, typename make_index_list<N>::type> Names;
+        return HTTP_HeaderTable(
+            StringDfa<Names::names, HTTP_BUILTIN_HEADER_COUNT + N,
+                        true>::comparator(),
+            specs, N);
+    }
+};
+
+#define HTTP_HEADER_TABLE(names, specs) \
+    HTTP_HeaderTable::create<names, sizeof(names) / sizeof(names[0])>(specs)
+
 const __FlashStringHelper* HTTPClientStateToString(http_request_state state);
 const __FlashStringHelper* HTTPStatusToString(http_status status);
 
@@ -75,57 +376,202 @@ class HTTP_Client
     friend class HTTP_Server;
 private:
     bool _connected = false;
-    Adafruit_CC3000_ClientRef _client = Adafruit_CC3000_ClientRef(NULL);
-    RingBuffer<HTTP_BUFFER_SIZE> _buffer;
+    bool _queued = false;       // In the server's ready queue
+    bool _waiting = false;      // In the server's queue for a buffer
+    unsigned long _readySince = 0;  // micros() when it was queued
+    bool _resume = false;       // Wants process() once writable
+    HTTP_TransportClient _client = HTTP_TransportClient(NULL);
+    PooledRingBuffer<HTTP_BUFFER_SIZE> _buffer;
+
+    /*
+     * Response bytes waiting to be sent together, or that the transport
+     * couldn't take yet. In a chunked body they're either bytes of a chunk
+     * that's still open, or already framed for the wire.
+     */
+    RingBuffer<HTTP_TX_BUFFER_SIZE> _txBuffer;
+    bool _chunkOpen = false;
+    size_t _chunkOwed = 0;      // Body bytes a sent chunk header promised
+    bool _txBlocked = false;    // The transport took less than it was given
+    bool _finishing = false;    // complete()d, but the response hasn't gone
+    unsigned long _flushes = 0;
 
     // Tracks the state of the http request
     http_request_state _requestState = http_request_state::METHOD;
     http_response_state _responseState = http_response_state::VERSION;
+    bool _chunkedResponse = false;
+
+    // Method, with the bytes of it read so far
+    static StringComparator _methodComparator;
+    http_method _method = http_method::UNKNOWN;
+    size_t _methodLength = 0;
 
     // Version information for the client
     static StringComparator _versionComparator;
     http_version _version;
 
-    // Important headers
+    // Important headers, and any the application subscribed to
     static StringComparator _headerComparator;
+    static const HTTP_HeaderTable _builtinHeaders;
+    const HTTP_HeaderTable* _headers = &_builtinHeaders;
     http_header _header;
+    size_t _subscribed = 0;     // Index in _headers when SUBSCRIBED
 
     // Transfer-Encoding
     static StringComparator _transferEncodingComparator;
     bool _chunked = false;
+    http_chunk_state _chunkState = http_chunk_state::SIZE;
 
-    // Content-Length
-    IntParser _intParser;
-    uintmax_t _contentLength = 0;
+    // Connection
+    static StringComparator _connectionComparator;
+    bool _keepAlive = false;
+
+    /*
+     * If-None-Match, with each tag's opaque part hashed so a tag of any
+     * length fits in four bytes. "W/" is dropped, as only weak comparison
+     * applies to it.
+     */
+    bool _hasIfNoneMatch = false;
+    bool _ifNoneMatchAny = false;       // "*"
+    http_etag_state _etagState = http_etag_state::BETWEEN;
+    uint8_t _ifNoneMatchCount = 0;
+    uint32_t _ifNoneMatch[HTTP_IF_NONE_MATCH_TAGS];
+
+    // Content-Length, or the bytes left in the current chunk when chunked
+    BasicIntParser<HTTP_LENGTH_TYPE> _intParser;
+    HTTP_LENGTH_TYPE _contentLength = 0;
+
+    // The route matched by the path so far, see route()
+    const StringComparator* _routes = NULL;
+    const http_methods* _routeMethods = NULL;
+    bool _routed = false;
+    bool _inQuery = false;      // Past the '?', so no longer matching
+    size_t _route = 0;
 
     // Reusable comparison
     StringComparison _comparison;
 
+    // Set by the server, see HTTP_Timeouts
+    http_timer _timer = http_timer::NONE;
+    unsigned long _received = 0;    // Bytes in since the body timer started
+    bool _timedOut = false;
+    bool _closed = false;
+
     void disconnect();
     void connect();
-    void client(Adafruit_CC3000_ClientRef c) { _client = c; }
+    void reset();
+    void client(HTTP_TransportClient c) { _client = c; }
+    http_timer timer() const;
+    bool pending();
 
     void getTransition(uint8_t& terminator, http_request_state& next);
-    void processState(uint8_t* buf, size_t n_buf);
+    void processState(const uint8_t* buf, size_t n_buf, bool last);
+    void processPath(const uint8_t* buf, size_t n_buf);
+    void readIfNoneMatch(const uint8_t* buf, size_t n_buf);
+    void checkPrefixRoute();
     http_status checkState();
 
     void requestState(http_request_state s);
     void responseState(http_response_state s);
 
-    http_status readTerminated(uint8_t* buf, size_t* n_buf);
-    http_status readBody(uint8_t* buf, size_t* n_buf);
+    /*
+     * The read path is shared by both forms of read(). With a buffer, bytes
+     * are copied into it and *data is set to buf; without one (buf == NULL),
+     * *data points into _buffer and the bytes are consumed in place.
+     */
+    http_status read(uint8_t* buf, const uint8_t** data, size_t* n_buf,
+                        http_request_state* current);
+    http_status readTerminated(uint8_t* buf, const uint8_t** data,
+                                size_t* n_buf);
+    http_status readBody(uint8_t* buf, const uint8_t** data, size_t* n_buf);
+    http_status readChunked(uint8_t* buf, const uint8_t** data,
+                            size_t* n_buf);
+    http_status chunkFraming(uint8_t c);
+
+    size_t take(uint8_t* buf, const uint8_t** data, size_t n);
+    size_t takeUntil(uint8_t* buf, const uint8_t** data, uint8_t terminator,
+                        size_t n);
 
     bool isValidResponseTransition(http_response_state s);
 
+    size_t put(const void* buf, size_t n);
+    size_t putChunked(const uint8_t* bytes, size_t n);
+    size_t putChunk(const uint8_t* bytes, size_t n);
+    size_t sendWire(const void* buf, size_t n, size_t reserve);
+    bool send();
+    bool drain(bool last);
+    size_t txFree(size_t reserve) const;
+    size_t room() const;
+    bool chunking() const;
+    static size_t chunkHeader(char* dest, size_t n);
+
+    bool fileHeaders(bool sized, HTTP_LENGTH_TYPE size, uint32_t tag);
+    bool writePart(http_response_state state, const __FlashStringHelper* str);
+    bool writePart(http_response_state state, const char* str);
+    bool ifNoneMatch(const char* opaque, size_t n) const;
+
 protected:
     HTTP_Client() = default;
 
+    // Also reports the values of the headers in the table, see header()
+    explicit HTTP_Client(const HTTP_HeaderTable& headers)
+        : _headers(&headers) {}
+
+    /*
+     * Matches the request path against the strings in routes as it arrives,
+     * see route(). A route ending in '*' matches any path that starts with
+     * the rest of it, and the longest such route wins when nothing matches
+     * exactly. The query string, from '?' on, isn't part of the match.
+     *
+     * With methods, one set per route, a request for a route with a method
+     * outside its set fails with FAIL_METHOD_NOT_ALLOWED as soon as the path
+     * has been read:
+     *
+     *     constexpr const char* const ROUTES[] = {"/", "/status", "/files*"};
+     *     static const StringComparator routes = STRING_COMPARATOR(ROUTES);
+     *     static const http_methods methods[] = {
+     *         HTTPMethodBit(http_method::GET), HTTP_ANY_METHOD, ...
+     */
+    explicit HTTP_Client(const StringComparator& routes,
+                            const http_methods* methods = NULL)
+        : _routes(&routes), _routeMethods(methods) {}
+
+    HTTP_Client(const HTTP_HeaderTable& headers,
+                const StringComparator& routes,
+                const http_methods* methods = NULL)
+        : _headers(&headers), _routes(&routes), _routeMethods(methods) {}
+
     http_version version() const { return _version; }
+    http_method method() const { return _method; }
     http_response_state responseState() const { return _responseState; }
+
+    // Whether the connection can be reused after this request
+    bool keepAlive() const { return _keepAlive; }
+
+    /*
+     * The index of the route matching the path, once read() has returned
+     * OKAY for the PATH state. False if there are no routes or none match.
+     */
+    bool route(size_t& idx) const;
     http_request_state requestState() const { return _requestState; }
 
     http_status read(uint8_t* buf, size_t* n_buf, http_request_state* current);
 
+    /*
+     * Like read(), but without the copy: *data is pointed at the bytes where
+     * they sit in the receive buffer, valid until the next read. A piece that
+     * wraps around the end of the buffer comes back over two calls, the
+     * first of them INCOMPLETE.
+     */
+    http_status read(const uint8_t** data, size_t* n_data,
+                        http_request_state* current);
+
+    /*
+     * Writes never wait for the network; they return how much was taken.
+     * Less than was given means the connection is backed up: call resume(),
+     * and write the rest from a later process(). Until the connection has
+     * taken the output, process() isn't called, even for input that's
+     * already buffered.
+     */
     size_t write(uint8_t* buf, size_t n);
     size_t write(const char* str);
     http_status write(uint8_t c);
@@ -133,35 +579,224 @@ protected:
 
     http_status advanceTo(http_response_state state);
 
+    /*
+     * Send the body with chunked transfer encoding, so its length doesn't
+     * have to be known up front. Call before advancing to BODY; the header is
+     * added then, each body write() becomes one chunk, and close() ends the
+     * body. HTTP/1.0 clients don't know about chunks, so they get the body
+     * as-is and it ends when the connection closes.
+     */
+    http_status chunked();
+
+    // Send whatever has been written so far, instead of waiting for more
+    http_status flush();
+
+    /*
+     * Answer with a file (see HTTP_File.h) the application has opened for
+     * the path. Call with the response at STATUS_CODE: the status, an ETag
+     * and Content-Length are written, or chunked() is used if the size
+     * isn't known, leaving the response at HEADER_NAME for other headers.
+     * Returns false when no body should follow: for HEAD, or when the
+     * request's If-None-Match shows the client has the file (a 304). Also
+     * false, with the connection closed, if the headers couldn't all be
+     * written.
+     */
+    template<typename F>
+    bool respondWithFile(F& file);
+
+    /*
+     * Send the next block of the file's body, read through buf, so buf only
+     * needs to hold one block (a sector, say). No more is read than the
+     * connection can take, so nothing read is lost when it's backed up.
+     * Returns INCOMPLETE, with resume() called, while there is more to
+     * send, and OKAY at the end.
+     */
+    template<typename F>
+    http_status writeFile(F& file, uint8_t* buf, size_t n);
+
+    /*
+     * End the response and the connection. Returns straight away: whatever
+     * was written is sent, and the server finishes closing over the next
+     * ticks while it gets on with the other clients.
+     */
     http_status close();
 
+    /*
+     * Finish the response. If the connection is kept alive it's made ready
+     * for the next request, including any that are already buffered;
+     * otherwise it's closed. The next request isn't started until the
+     * connection has taken this response: until then read() is INCOMPLETE.
+     */
+    http_status complete();
+
+    /*
+     * Ask for process() to be called again once the connection can take more
+     * output, even if no new input arrives. Without this, process() only runs
+     * while there is unread input.
+     */
+    void resume() { _resume = true; }
+
     virtual void process() =0;
 
+    /*
+     * Called from within read() with the value of each header in the table
+     * given to the constructor, once the whole value has been read; or for
+     * a SPAN, with each piece as it's read. It mustn't call read() itself.
+     */
+    virtual void header(const http_header_event& e) { (void)e; }
+
 public:
     bool connected() const { return _connected; }
+
+    // Writes handed to the transport since the connection opened
+    unsigned long flushes() const { return _flushes; }
+
     virtual ~HTTP_Client() = default;
 };
 
+template<typename F>
+bool HTTP_Client::respondWithFile(F& file)
+{
+    typename F::size_type size = 0;
+    bool sized = file.size(&size);
+    return fileHeaders(sized, static_cast<HTTP_LENGTH_TYPE>(size), file.tag());
+}
+
+template<typename F>
+http_status HTTP_Client::writeFile(F& file, uint8_t* buf, size_t n)
+{
+    if (http_response_state::BODY != _responseState) {
+        http_status status = advanceTo(http_response_state::BODY);
+        if (http_status::OKAY != status) {
+            return status;
+        }
+    }
+
+    // Only read what can be taken, making room first if it's short
+    size_t space = room();
+    if (space < n) {
+        if (!drain(false)) {
+            return http_status::FAIL_HARDWARE;
+        }
+        space = room();
+        if (0 == space) {
+            resume();
+            return http_status::INCOMPLETE;
+        }
+    }
+
+    int r = file.read(buf, space < n ? space : n);
+    if (0 > r) {
+        return http_status::FAIL_HARDWARE;
+    } else if (0 == r) {
+        return http_status::OKAY;
+    } else if (static_cast<size_t>(r) != write(buf, r)) {
+        return http_status::FAIL_HARDWARE;
+    }
+
+    resume();
+    return http_status::INCOMPLETE;
+}
+
 class HTTP_Server
 {
 private:
+#ifdef ARDUINO
     Adafruit_CC3000 _cc3000;
-    Adafruit_CC3000_Server _server;
+#endif
+    HTTP_TransportServer _server;
+
+    // Clients with input to parse or waiting on output, in arrival order
+    size_t _ready[HTTP_MAX_CLIENTS];
+    size_t _readyStart = 0;
+    size_t _readyCount = 0;
+
+    // Receive buffers, lent to clients with input to parse
+    BufferPool<HTTP_BUFFER_SIZE, HTTP_BUFFER_POOL_SIZE> _pool;
+    unsigned long _bufferWaits = 0;
+
+    // Clients with input but no buffer, their reads suspended, in order
+    size_t _waiters[HTTP_MAX_CLIENTS];
+    size_t _waitStart = 0;
+    size_t _waitCount = 0;
+
+    // When each client's current limit runs out
+    TimerWheel<HTTP_MAX_CLIENTS, HTTP_TIMER_SLOTS, HTTP_TIMER_RESOLUTION>
+        _timers;
+    HTTP_Timeouts _timeouts;
+    unsigned long _evictions = 0;
+
+    HTTP_Budget _budget;
+    HTTP_SchedulerStats _stats;
+
+    void schedule(size_t idx);
+    void turn(HTTP_Client& httpClient);
+    bool lend(HTTP_Client& httpClient);
+    void reclaim(HTTP_Client& httpClient);
+    void wait(size_t idx);
+    void unwait(size_t idx);
+    unsigned long limit(http_timer timer) const;
+    void arm(size_t idx, unsigned long now);
+    bool expired(size_t idx, unsigned long now);
+    void linger(size_t idx, unsigned long now);
+    void writable(size_t idx, unsigned long now);
 
 protected:
     virtual HTTP_Client& client(size_t idx) =0;
 
+    /*
+     * The clock timeouts are measured on, and how long tick() may wait for
+     * the network when no client has work. Tests replace both, to step
+     * through the limits rather than wait them out.
+     */
+    virtual unsigned long clockMillis() { return millis(); }
+    virtual int pollTimeout() { return HTTP_TRANSPORT_POLL_TIMEOUT; }
+
 public:
+#ifdef ARDUINO
     HTTP_Server(uint8_t cs, uint8_t irq, uint8_t vbat, uint8_t spi_div,
                 uint16_t port = 80);
+#else
+    explicit HTTP_Server(uint16_t port = 80);
+
+    uint16_t port() const { return _server.port(); }
+#endif
 
     http_status begin();
 
+#ifdef ARDUINO
     http_status connect(const char* ssid, const char* key, uint8_t secmode,
             uint8_t attempts = 0);
+#endif
 
     http_status tick();
 
+    /*
+     * Receive buffers not lent out, and how many times input was left
+     * waiting because there were none. A pool that keeps running dry is
+     * the sign to turn away connections, or to make it bigger.
+     */
+    size_t buffersFree() const { return _pool.available(); }
+    unsigned long bufferWaits() const { return _bufferWaits; }
+
+    /*
+     * A client that runs out of time has read() fail with FAIL_TIMEOUT, so
+     * the application can answer (with a 408, say), and is then closed.
+     * Changes apply to limits started afterwards.
+     */
+    const HTTP_Timeouts& timeouts() const { return _timeouts; }
+    void timeouts(const HTTP_Timeouts& t) { _timeouts = t; }
+
+    // Clients closed for running out of time
+    unsigned long evictions() const { return _evictions; }
+
+    const HTTP_Budget& budget() const { return _budget; }
+    void budget(const HTTP_Budget& b) { _budget = b; }
+
+    // Since the server started, or since the last resetStats()
+    const HTTP_SchedulerStats& stats() const { return _stats; }
+    void resetStats() { _stats = HTTP_SchedulerStats(); }
+
     virtual ~HTTP_Server() = default;
 };
 
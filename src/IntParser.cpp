@@ -1,72 +1,151 @@
 #include "IntParser.h"
 
+#include <string.h>
+
+/*
+ * GCC 5 and clang check for overflow with the processor's flags, at the
+ * width of the result. Elsewhere, next() compares against the largest value
+ * that can take another digit, and feed() falls back to next().
+ */
+#if !defined(INTPARSER_NO_BUILTINS) \
+        && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#   define INTPARSER_BUILTIN_OVERFLOW
+#endif
+
 template<typename T>
-static bool add_with_overflow_check(T a, T b, T* r)
+void BasicIntParser<T>::reset(uint8_t base)
 {
-	static_assert(static_cast<T>(0) - static_cast<T>(1) > static_cast<T>(0),
-			"only valid with unsigned types");
-	*r = a + b;
-	return a <= *r && b <= *r;
+	_overflowed = false;
+	_invalid = false;
+	_base = base;
+	_value = 0;
 }
 
 template<typename T>
-static bool mult_with_overflow_check(T, T, T*);
-
-template<>
-bool mult_with_overflow_check(uint64_t a, uint64_t b, uint64_t* r)
+void BasicIntParser<T>::next(uint8_t c)
 {
-	// Put the smallest number in a
-	if (a > b) {
-		uintmax_t t = a;
-		a = b;
-		b = t;
+	if (_invalid || _overflowed) {
+		return;
 	}
 
-	if (a > UINT32_MAX) {
-		return false;
+	uint8_t d;
+	if (c >= '0' && c <= '9') {
+		d = c - '0';
+	} else if (16 == _base && c >= 'a' && c <= 'f') {
+		d = c - 'a' + 10u;
+	} else if (16 == _base && c >= 'A' && c <= 'F') {
+		d = c - 'A' + 10u;
+	} else {
+		_invalid = true;
+		return;
 	}
 
-	uint32_t c = b >> 32;			// Top half of b
-	uint32_t d = UINT32_MAX & b;	// Bottom half of b
-	uint64_t u = a * c;				// Multiply a with most sig. bits of b
-	uint64_t v = a * d;				// Multiply a with least sig. bits of b
+#ifdef INTPARSER_BUILTIN_OVERFLOW
+	_overflowed = __builtin_mul_overflow(_value, _base, &_value)
+		|| __builtin_add_overflow(_value, d, &_value);
+#else
+	static const T MAX = static_cast<T>(-1);
 
-	if (u > UINT32_MAX) {
-		return false;				// The most sig. bits overflow, so fail
+	// The largest value that can take any digit, and the largest digit the
+	// value after it can take
+	T limit = 16 == _base ? MAX / 16 : MAX / 10;
+	uint8_t last = 16 == _base ? MAX % 16 : MAX % 10;
+
+	if (_value > limit || (_value == limit && d > last)) {
+		_overflowed = true;
+		return;
 	}
 
-	u <<= 32;
+	_value = _value * _base + d;
+#endif
+}
+
+/*
+ * feed() works on 8 digits at a time in a uint64_t, which only pays off
+ * where that is a machine word. On 8-bit AVR every shift, mask and multiply
+ * of it becomes a library call, so it keeps to next().
+ */
+#if defined(INTPARSER_BUILTIN_OVERFLOW) && !defined(INTPARSER_NO_SWAR) \
+        && defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ >= 8 \
+        && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define INTPARSER_SWAR
+#endif
 
-	return add_with_overflow_check(u, v, r);
+#ifdef INTPARSER_SWAR
+static const uint32_t POWERS_OF_TEN[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+// Whether all 8 bytes of v are ASCII decimal digits
+static bool all_digits(uint64_t v)
+{
+	return (v & UINT64_C(0xF0F0F0F0F0F0F0F0)) == UINT64_C(0x3030303030303030)
+		&& ((v + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0))
+			== UINT64_C(0x3030303030303030);
 }
 
-void IntParser::reset()
+/*
+ * The value of 8 decimal digits, first digit in the lowest byte. Adjacent
+ * digits are combined into pairs, pairs into fours, and fours into the
+ * result, each step one multiply across the whole word.
+ */
+static uint32_t swar_digits(uint64_t v)
 {
-	_overflowed = false;
-	_invalid = false;
-	_value = 0;
+	v &= UINT64_C(0x0F0F0F0F0F0F0F0F);
+	v = (v * 10 + (v >> 8)) & UINT64_C(0x00FF00FF00FF00FF);
+	v = (v * 100 + (v >> 16)) & UINT64_C(0x0000FFFF0000FFFF);
+	v = (v * 10000 + (v >> 32)) & UINT64_C(0x00000000FFFFFFFF);
+	return static_cast<uint32_t>(v);
 }
 
-void IntParser::next(uint8_t c)
+template<typename T>
+void BasicIntParser<T>::feed(const uint8_t* p, size_t n)
 {
-	if (_invalid || _overflowed) {
+	if (10 != _base) {
+		for (size_t ii = 0; ii < n; ii++) {
+			next(p[ii]);
+		}
 		return;
 	}
 
-	if (c < 48 || c > 57) {
-		_invalid = true;
-		return;
-	}
+	while (n > 0 && !_invalid && !_overflowed) {
+		size_t k = n < 8 ? n : 8;
 
-	_overflowed = !mult_with_overflow_check(_value, static_cast<uintmax_t>(10u),
-				&_value);
+		uint64_t v;
+		if (8 == k) {
+			memcpy(&v, p, 8);
+		} else {
+			// A short group is shifted in on top of leading zeros
+			v = UINT64_C(0x3030303030303030);
+			for (size_t ii = 0; ii < k; ii++) {
+				v = (v >> 8) | static_cast<uint64_t>(p[ii]) << 56;
+			}
+		}
 
-	if (_overflowed) {
-		return;
-	}
+		if (!all_digits(v)) {
+			_invalid = true;
+			return;
+		}
 
-	uint8_t d = c - 48u;
+		// The group may not fit in T even on its own; the builtins check
+		// against the width of _value whatever the operands are
+		_overflowed = __builtin_mul_overflow(_value, POWERS_OF_TEN[k], &_value)
+			|| __builtin_add_overflow(_value, swar_digits(v), &_value);
 
-	_overflowed = !add_with_overflow_check(_value, static_cast<uintmax_t>(d),
-			&_value);
+		p += k;
+		n -= k;
+	}
+}
+#else
+template<typename T>
+void BasicIntParser<T>::feed(const uint8_t* p, size_t n)
+{
+	for (size_t ii = 0; ii < n; ii++) {
+		next(p[ii]);
+	}
 }
+#endif
+
+template class BasicIntParser<uint16_t>;
+template class BasicIntParser<uint32_t>;
+template class BasicIntParser<uintmax_t>;
@@ -4,20 +4,40 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-class IntParser
+/*
+ * Parses an unsigned integer of type T a byte at a time, noting rather than
+ * wrapping on overflow. T is uint16_t, uint32_t or uintmax_t; pick the
+ * narrowest that holds the values you accept, since every digit costs a
+ * multiply of that width.
+ */
+template<typename T>
+class BasicIntParser
 {
 private:
     bool _overflowed = false;
     bool _invalid = false;
-    uintmax_t _value = 0;
+    uint8_t _base = 10;
+    T _value = 0;
 
 public:
-    void reset();
+    // base is either 10, or 16 for (case-insensitive) hexadecimal
+    void reset(uint8_t base = 10);
     void next(uint8_t c);
-    bool value(uintmax_t* v) const { *v = _value; return !_overflowed && !_invalid; }
+
+    /*
+     * The same as calling next() on each of the n bytes at p. On 64-bit
+     * targets, decimal digits are converted up to 8 at a time, with one
+     * overflow check for each group; elsewhere it's next() for each byte.
+     * Numbers can still be split over several calls.
+     */
+    void feed(const uint8_t* p, size_t n);
+
+    bool value(T* v) const { *v = _value; return !_overflowed && !_invalid; }
 
     bool overflowed() const { return _overflowed; }
     bool invalid() const { return _invalid; }
 };
 
+typedef BasicIntParser<uintmax_t> IntParser;
+
 #endif /* INTPARSER_H */
@@ -0,0 +1,78 @@
+#ifndef ARDUINO
+#include "Platform.h"
+
+#include <stdio.h>
+#include <time.h>
+
+HostSerial Serial;
+
+void delay(unsigned long ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+unsigned long millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+}
+
+unsigned long micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000L;
+}
+
+size_t HostSerial::printNumber(unsigned long long n, int base)
+{
+    return printf(16 == base ? "%llX" : "%llu", n);
+}
+
+size_t HostSerial::print(const char* str)
+{
+    return fputs(str, stdout) < 0 ? 0 : strlen(str);
+}
+
+size_t HostSerial::print(const __FlashStringHelper* str)
+{
+    return print(reinterpret_cast<const char*>(str));
+}
+
+size_t HostSerial::print(char c)
+{
+    return EOF == putchar(c) ? 0 : 1;
+}
+
+size_t HostSerial::print(int n, int base)
+{
+    return print(static_cast<long>(n), base);
+}
+
+size_t HostSerial::print(unsigned int n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t HostSerial::print(long n, int base)
+{
+    if (0 > n && DEC == base) {
+        return print('-') + printNumber(-static_cast<unsigned long long>(n), base);
+    }
+    return printNumber(static_cast<unsigned long>(n), base);
+}
+
+size_t HostSerial::print(unsigned long n, int base)
+{
+    return printNumber(n, base);
+}
+
+size_t HostSerial::println()
+{
+    return print("\r\n");
+}
+#endif /* ARDUINO */
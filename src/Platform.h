@@ -0,0 +1,57 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+ * The handful of Arduino APIs the server relies on. On the device these come
+ * straight from the core; host builds get minimal stand-ins so that the same
+ * request/response state machine can run (and be tested) off-device.
+ */
+#ifdef ARDUINO
+#   include <Arduino.h>
+#   include <avr/pgmspace.h>
+#else
+#   include <stdint.h>
+#   include <stddef.h>
+#   include <string.h>
+
+class __FlashStringHelper;
+
+#   define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#   define PROGMEM
+#   define pgm_read_byte(p) (*reinterpret_cast<const uint8_t*>(p))
+#   define strlen_P(s) strlen(s)
+
+#   define DEC 10
+#   define HEX 16
+
+void delay(unsigned long ms);
+unsigned long millis();
+unsigned long micros();
+
+class HostSerial
+{
+private:
+    size_t printNumber(unsigned long long n, int base);
+
+public:
+    size_t print(const char* str);
+    size_t print(const __FlashStringHelper* str);
+    size_t print(char c);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+
+    size_t println();
+
+    template<typename T>
+    size_t println(T v) { size_t n = print(v); return n + println(); }
+
+    template<typename T>
+    size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+extern HostSerial Serial;
+#endif /* ARDUINO */
+
+#endif /* PLATFORM_H */
@@ -0,0 +1,67 @@
+#ifndef ARDUINO
+#include "PosixFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool PosixFile::open(const char* path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (0 > fd) {
+        return false;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    _fd = fd;
+    _size = st.st_size;
+
+    // Any rewrite moves the modification time; the inode covers a file
+    // being swapped for another with the same time
+    uint64_t mixed = (static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000u
+                        + st.st_mtim.tv_nsec) ^ (st.st_ino << 32);
+    _tag = static_cast<uint32_t>(mixed ^ (mixed >> 32));
+    return true;
+}
+
+void PosixFile::close()
+{
+    if (isOpen()) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool PosixFile::size(size_type* n) const
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    *n = _size;
+    return true;
+}
+
+int PosixFile::read(uint8_t* buf, size_t n)
+{
+    if (!isOpen()) {
+        return -1;
+    }
+
+    ssize_t r;
+    do {
+        r = ::read(_fd, buf, n);
+    } while (0 > r && EINTR == errno);
+
+    return static_cast<int>(r);
+}
+
+#endif /* ARDUINO */
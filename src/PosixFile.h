@@ -0,0 +1,36 @@
+#ifndef POSIXFILE_H
+#define POSIXFILE_H
+
+/*
+ * Host file source, a regular file read with plain POSIX calls. Only one
+ * block is ever held, in the caller's buffer.
+ */
+#include "Platform.h"
+
+class PosixFile
+{
+private:
+    int _fd = -1;
+    uintmax_t _size = 0;
+    uint32_t _tag = 0;
+
+public:
+    typedef uintmax_t size_type;
+
+    PosixFile() = default;
+    PosixFile(const PosixFile&) = delete;
+    PosixFile& operator=(const PosixFile&) = delete;
+    ~PosixFile() { close(); }
+
+    // Fails for anything but a regular file, directories included
+    bool open(const char* path);
+    bool isOpen() const { return 0 <= _fd; }
+    void close();
+
+    bool size(size_type* n) const;
+    uint32_t tag() const { return _tag; }
+
+    int read(uint8_t* buf, size_t n);
+};
+
+#endif /* POSIXFILE_H */
@@ -0,0 +1,417 @@
+#ifndef ARDUINO
+#include "PosixTransport.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// epoll tag used for the listening socket, past the end of the client slots
+static const uint64_t LISTENER = POSIX_MAX_CLIENTS;
+
+static bool wouldBlock(int err)
+{
+    return EAGAIN == err || EWOULDBLOCK == err || EINTR == err;
+}
+
+/*****************************************************************************
+ * PosixClientRef Implementation                                             *
+ *****************************************************************************/
+bool PosixClientRef::connected()
+{
+    if (NULL == _server) {
+        return false;
+    }
+
+    PosixServer::Socket& s = _server->_sockets[_idx];
+    return 0 <= s.fd && !s.eof;
+}
+
+int PosixClientRef::available()
+{
+    if (!connected()) {
+        return 0;
+    }
+
+    int n = 0;
+    if (0 > ioctl(_server->_sockets[_idx].fd, FIONREAD, &n)) {
+        return 0;
+    }
+    return n;
+}
+
+int PosixClientRef::read()
+{
+    uint8_t c;
+    if (1 != read(&c, 1)) {
+        return -1;
+    }
+    return c;
+}
+
+int PosixClientRef::read(void* buf, uint16_t len, uint32_t flags)
+{
+    if (!connected()) {
+        return -1;
+    }
+
+    PosixServer::Socket& s = _server->_sockets[_idx];
+    ssize_t r = recv(s.fd, buf, len, flags | MSG_DONTWAIT);
+    if (0 < r) {
+        return r;
+    } else if (0 > r && wouldBlock(errno)) {
+        return 0;
+    }
+
+    // Orderly shutdown by the peer, or a failed socket
+    s.eof = true;
+    _server->hangup(_idx);
+    return -1;
+}
+
+size_t PosixClientRef::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+/*
+ * Never waits: returns as much as the socket would take, which is short
+ * when its send buffer is full. The server keeps the rest, and asks with
+ * notifyWritable() to hear when there's room.
+ */
+size_t PosixClientRef::write(const void* buf, uint16_t len, uint32_t flags)
+{
+    if (!connected()) {
+        return 0;
+    }
+
+    PosixServer::Socket& s = _server->_sockets[_idx];
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t r = send(s.fd, p + sent, len - sent,
+                            flags | MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (0 <= r) {
+            sent += r;
+        } else if (EINTR == errno) {
+            continue;
+        } else {
+            if (!wouldBlock(errno)) {
+                s.eof = true;
+                _server->hangup(_idx);
+            }
+            break;
+        }
+    }
+
+    return sent;
+}
+
+size_t PosixClientRef::fastrprint(const char* str)
+{
+    size_t len = strlen(str);
+    size_t sent = 0;
+
+    while (sent < len) {
+        uint16_t n = len - sent > UINT16_MAX ? UINT16_MAX : len - sent;
+        size_t r = write(str + sent, n);
+        sent += r;
+        if (r != n) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+size_t PosixClientRef::fastrprint(const __FlashStringHelper* str)
+{
+    return fastrprint(reinterpret_cast<const char*>(str));
+}
+
+void PosixClientRef::close()
+{
+    if (NULL == _server) {
+        return;
+    }
+
+    PosixServer::Socket& s = _server->_sockets[_idx];
+    if (0 > s.fd) {
+        return;
+    }
+
+    // Closing also drops the socket from the epoll set
+    ::close(s.fd);
+    s.fd = -1;
+    _server->hangup(_idx);
+}
+
+/*****************************************************************************
+ * PosixServer Implementation                                                *
+ *****************************************************************************/
+PosixServer::PosixServer(uint16_t port)
+    : _port(port)
+{
+    // Hand out the lowest slots first
+    for (size_t ii = POSIX_MAX_CLIENTS; ii > 0; ii--) {
+        _free[_freeCount++] = ii - 1;
+    }
+}
+
+bool PosixServer::begin()
+{
+    _listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (0 > _listener || 0 > _epoll) {
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_port);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTENER;
+
+    socklen_t len = sizeof(addr);
+    if (0 > bind(_listener, reinterpret_cast<struct sockaddr*>(&addr), len)
+            || 0 > listen(_listener, SOMAXCONN)
+            || 0 > getsockname(_listener,
+                                reinterpret_cast<struct sockaddr*>(&addr),
+                                &len)
+            || 0 > epoll_ctl(_epoll, EPOLL_CTL_ADD, _listener, &ev)) {
+        ::close(_listener);
+        _listener = -1;
+        return false;
+    }
+
+    // Learn the real port when an ephemeral one (0) was requested
+    _port = ntohs(addr.sin_port);
+    return true;
+}
+
+PosixClientRef PosixServer::getClientRef(size_t idx)
+{
+    if (idx >= POSIX_MAX_CLIENTS) {
+        return PosixClientRef(NULL);
+    }
+    return PosixClientRef(this, idx);
+}
+
+void PosixServer::hangup(size_t idx)
+{
+    Socket& s = _sockets[idx];
+    if (!s.hangup) {
+        s.hangup = true;
+        _hangups[(_hangupStart + _hangupCount) % POSIX_MAX_CLIENTS] = idx;
+        _hangupCount++;
+    }
+}
+
+bool PosixServer::watch(size_t idx, bool add)
+{
+    Socket& s = _sockets[idx];
+
+    struct epoll_event ev;
+    ev.events = s.suspended ? 0 : EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = idx;
+
+    if (s.writable) {
+        ev.events |= EPOLLOUT;
+    }
+
+    return 0 <= epoll_ctl(_epoll, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s.fd,
+                            &ev);
+}
+
+void PosixServer::notifyWritable(size_t idx)
+{
+    Socket& s = _sockets[idx];
+    if (0 <= s.fd && !s.hangup && !s.writable) {
+        s.writable = true;
+        watch(idx, false);
+    }
+}
+
+void PosixServer::suspendReads(size_t idx)
+{
+    Socket& s = _sockets[idx];
+    if (0 <= s.fd && !s.hangup && !s.suspended) {
+        s.suspended = true;
+        watch(idx, false);
+    }
+}
+
+void PosixServer::resumeReads(size_t idx)
+{
+    Socket& s = _sockets[idx];
+    if (0 <= s.fd && !s.hangup && s.suspended) {
+        s.suspended = false;
+        watch(idx, false);
+    }
+}
+
+void PosixServer::shutdown(size_t idx)
+{
+    Socket& s = _sockets[idx];
+    if (0 <= s.fd && !s.hangup) {
+        ::shutdown(s.fd, SHUT_WR);
+    }
+}
+
+size_t PosixServer::acceptNewConnections(TransportEvent* events, size_t n)
+{
+    size_t count = 0;
+
+    while (count < n && _freeCount > 0) {
+        int fd = accept4(_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (0 > fd) {
+            break; // Nothing left in the backlog
+        }
+
+        size_t idx = _free[--_freeCount];
+        Socket& s = _sockets[idx];
+        s.fd = fd;
+        s.eof = false;
+        s.writable = false;
+        s.suspended = false;
+
+        if (!watch(idx, true)) {
+            ::close(fd);
+            s.fd = -1;
+            _free[_freeCount++] = idx;
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        events[count++] = {idx, transport_event::CONNECTED};
+    }
+
+    if (0 == _freeCount) {
+        // Leave new connections in the backlog until a slot frees up,
+        // instead of waking up for them on every poll
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, _listener, NULL);
+    }
+
+    return count;
+}
+
+size_t PosixServer::poll(TransportEvent* events, size_t n, int timeout)
+{
+    size_t count = 0;
+
+    if (0 > _epoll) {
+        return 0;
+    }
+
+    /* Report closed connections and recycle their slots */
+    bool wasFull = 0 == _freeCount;
+    while (count < n && _hangupCount > 0) {
+        size_t idx = _hangups[_hangupStart];
+        _hangupStart = (_hangupStart + 1) % POSIX_MAX_CLIENTS;
+        _hangupCount--;
+        Socket& s = _sockets[idx];
+
+        if (0 <= s.fd) {
+            ::close(s.fd);
+            s.fd = -1;
+        }
+        s.eof = false;
+        s.hangup = false;
+        s.writable = false;
+        s.suspended = false;
+
+        _free[_freeCount++] = idx;
+        events[count++] = {idx, transport_event::DISCONNECTED};
+    }
+
+    if (wasFull && 0 < _freeCount) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTENER;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, _listener, &ev);
+    }
+
+    if (0 < count) {
+        timeout = 0;
+    }
+
+    // Leave room for every socket to be both readable and writable
+    size_t room = (n - count) / 2;
+    if (room > POSIX_EVENTS) {
+        room = POSIX_EVENTS;
+    }
+    if (0 == room) {
+        return count;
+    }
+
+    struct epoll_event ready[POSIX_EVENTS];
+    int r = epoll_wait(_epoll, ready, room, timeout);
+    bool accept = false;
+
+    for (int ii = 0; ii < r; ii++) {
+        uint64_t idx = ready[ii].data.u64;
+        if (LISTENER == idx) {
+            accept = true;
+            continue;
+        }
+
+        Socket& s = _sockets[idx];
+        if (0 > s.fd || s.hangup) {
+            continue; // Already on its way out
+        }
+
+        uint32_t e = ready[ii].events;
+        if (s.suspended && (e & (EPOLLHUP | EPOLLERR))) {
+            // Always reported, and nobody is going to read to find them
+            s.eof = true;
+            hangup(idx);
+            continue;
+        } else if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            // Hangups and errors are found by the next read
+            events[count++] = {idx, transport_event::READABLE};
+        }
+
+        if (e & EPOLLOUT) {
+            s.writable = false;
+            watch(idx, false);
+            events[count++] = {idx, transport_event::WRITABLE};
+        }
+    }
+
+    if (accept) {
+        count += acceptNewConnections(events + count, n - count);
+    }
+
+    return count;
+}
+
+PosixServer::~PosixServer()
+{
+    for (size_t ii = 0; ii < POSIX_MAX_CLIENTS; ii++) {
+        if (0 <= _sockets[ii].fd) {
+            ::close(_sockets[ii].fd);
+        }
+    }
+
+    if (0 <= _epoll) {
+        ::close(_epoll);
+    }
+
+    if (0 <= _listener) {
+        ::close(_listener);
+    }
+}
+#endif /* ARDUINO */
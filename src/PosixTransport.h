@@ -0,0 +1,143 @@
+#ifndef POSIXTRANSPORT_H
+#define POSIXTRANSPORT_H
+
+/*
+ * Host transport built on non-blocking POSIX sockets and epoll. The client
+ * reference mirrors the subset of Adafruit_CC3000_ClientRef that HTTP_Client
+ * uses, so the same tick()/process() code runs unchanged on Linux.
+ */
+#include "Platform.h"
+#include "RingBuffer.h"
+#include "TransportEvent.h"
+
+#ifndef POSIX_RXBUFFERSIZE
+#   define POSIX_RXBUFFERSIZE 1024
+#endif
+
+#ifndef POSIX_TXBUFFERSIZE
+#   define POSIX_TXBUFFERSIZE 1024
+#endif
+
+#ifndef POSIX_MAX_CLIENTS
+#   define POSIX_MAX_CLIENTS 1024
+#endif
+
+// Receive buffers shared by the clients, see HTTP_BUFFER_POOL_SIZE
+#ifndef POSIX_BUFFERS
+#   define POSIX_BUFFERS 16
+#endif
+
+// Most epoll events fetched per poll()
+#ifndef POSIX_EVENTS
+#   define POSIX_EVENTS 64
+#endif
+
+// Milliseconds poll() may sleep when the server has nothing else to do
+#ifndef POSIX_POLL_TIMEOUT
+#   define POSIX_POLL_TIMEOUT 10
+#endif
+
+// Milliseconds to wait for the peer to hang up after a half-close
+#ifndef POSIX_CLOSE_TIMEOUT
+#   define POSIX_CLOSE_TIMEOUT 2000
+#endif
+
+class PosixServer;
+
+class PosixClientRef
+{
+private:
+    PosixServer* _server;
+    size_t _idx;
+
+public:
+    explicit PosixClientRef(PosixServer* server, size_t idx = 0)
+        : _server(server), _idx(idx) {}
+
+    bool connected();
+    int available();
+
+    int read();
+    int read(void* buf, uint16_t len, uint32_t flags = 0);
+
+    size_t write(uint8_t c);
+    size_t write(const void* buf, uint16_t len, uint32_t flags = 0);
+    size_t fastrprint(const char* str);
+    size_t fastrprint(const __FlashStringHelper* str);
+
+    void close();
+};
+
+template<>
+struct RingBufferTraits<PosixClientRef>
+{
+    static const bool bulkRead = true;
+};
+
+class PosixServer
+{
+    friend class PosixClientRef;
+private:
+    struct Socket
+    {
+        int fd = -1;
+        bool eof = false;       // Peer closed, or the socket failed
+        bool hangup = false;    // Queued to be reported as DISCONNECTED
+        bool writable = false;  // Waiting for EPOLLOUT
+        bool suspended = false; // Not watched for input
+    };
+
+    uint16_t _port;
+    int _listener = -1;
+    int _epoll = -1;
+
+    Socket _sockets[POSIX_MAX_CLIENTS];
+
+    // Slots with no connection, used as a stack
+    size_t _free[POSIX_MAX_CLIENTS];
+    size_t _freeCount = 0;
+
+    // Slots closed since the last poll(), in order
+    size_t _hangups[POSIX_MAX_CLIENTS];
+    size_t _hangupStart = 0;
+    size_t _hangupCount = 0;
+
+    void hangup(size_t idx);
+    bool watch(size_t idx, bool writable);
+    size_t acceptNewConnections(TransportEvent* events, size_t n);
+
+public:
+    explicit PosixServer(uint16_t port);
+    PosixServer(const PosixServer&) = delete;
+    PosixServer& operator=(const PosixServer&) = delete;
+
+    bool begin();
+    uint16_t port() const { return _port; }
+
+    PosixClientRef getClientRef(size_t idx);
+
+    size_t poll(TransportEvent* events, size_t n, int timeout);
+    void notifyWritable(size_t idx);
+
+    // Stop reporting input, leaving it with the socket, and start again
+    void suspendReads(size_t idx);
+    void resumeReads(size_t idx);
+
+    // Half-close: the peer reads to the end, but can still send
+    void shutdown(size_t idx);
+
+    ~PosixServer();
+};
+
+typedef PosixServer HTTP_TransportServer;
+typedef PosixClientRef HTTP_TransportClient;
+
+#define HTTP_TRANSPORT_RXBUFFERSIZE POSIX_RXBUFFERSIZE
+#define HTTP_TRANSPORT_TXBUFFERSIZE POSIX_TXBUFFERSIZE
+#define HTTP_TRANSPORT_MAX_CLIENTS POSIX_MAX_CLIENTS
+#define HTTP_TRANSPORT_BUFFERS POSIX_BUFFERS
+#define HTTP_TRANSPORT_EVENTS (2 * POSIX_EVENTS)
+#define HTTP_TRANSPORT_POLL_TIMEOUT POSIX_POLL_TIMEOUT
+#define HTTP_TRANSPORT_CLOSE_TIMEOUT POSIX_CLOSE_TIMEOUT
+
+#endif /* POSIXTRANSPORT_H */
@@ -10,50 +10,53 @@
         typedef ::size_t size_t;
     }
 #else
+#   include <atomic>
 #   include <cstdint>
 #   include <cstring>
 #endif
 
-template<std::size_t S>
-class RingBuffer
+#include "ByteScan.h"
+
+/*
+ * Describes how RingBuffer::readFrom pulls bytes out of a source of type T.
+ *
+ * By default a source is drained one byte at a time through connected(),
+ * available() and read(). Transports whose read(void*, uint16_t) is
+ * non-blocking and shares its buffering with read() can specialize this with
+ * bulkRead = true, and readFrom will fill the buffer with at most two block
+ * reads instead.
+ */
+template<typename T>
+struct RingBufferTraits
+{
+    static const bool bulkRead = false;
+};
+
+/*
+ * A run of buffered bytes, pointing into the buffer itself rather than at a
+ * copy. It stays valid until those bytes are consumed.
+ */
+struct RingBufferSpan
+{
+    const uint8_t* data;
+    std::size_t length;
+};
+
+/*
+ * Where the buffered bytes of a RingBuffer<S> are. This version works for
+ * any S, using _start == _end == 0 to tell an empty buffer from a full one.
+ */
+template<std::size_t S, bool P = 0 == (S & (S - 1))>
+class RingBufferIndex
 {
 private:
-    uint8_t _buffer[S];
     std::size_t _start = 0;
     std::size_t _end = 0;
 
     // _start == 0 && _end == 0 means empty buffer
     // (_start == _end || (_start == 0 && _end == S)) means full buffer
 
-    void advanceStart(std::size_t n) {
-        _start += n;
-        if (_start == _end) {
-            // if _start == _end then we've emptied the buffer, so reset
-            _start = 0;
-            _end = 0;
-        } else if (_start >= S) {
-            _start %= S;
-        }
-    }
-
-    template<typename U>
-    U _min(U a, U b) { return a < b ? a : b; }
-
-    template<typename U>
-    U _max(U a, U b) { return a > b ? a : b; }
-
-    std::size_t availableTogether() {
-        if (_start == _end && _start == 0) {
-            return 0; // Empty buffer
-        } else if (_start >= _end) {
-            return S - _start; // Read until end of buffer
-        } else {
-            return _end - _start;
-        }
-    }
-
 public:
-    std::size_t capacity() const { return S; }
     std::size_t available() const {
         if (_end == _start) {
             if (_end == 0) {
@@ -66,31 +69,303 @@ public:
         }
     }
 
-    template<typename T>
-    size_t readFrom(T& instance) {
-        std::size_t n;
-        std::size_t p = _end;
+    std::size_t start() const { return _start; }
+
+    // Contiguous free space starting at *pos, 0 if the buffer is full
+    std::size_t freeTogether(std::size_t* pos) const {
+        *pos = _end;
         if (_end == _start) {
-            if (_end == 0) {
-                n = S; // Empty
-            } else {
-                return 0; // No room
-            }
+            return 0 == _end ? S : 0; // Empty or full
         } else if (S == _end) {
-            // Wrap around
-            p = 0;
-            n = _start;
+            *pos = 0; // Wrap around
+            return _start;
         } else if (_end > _start) {
-            n = S - _end;
+            return S - _end;
         } else {
-            n = _start - _end;
+            return _start - _end;
+        }
+    }
+
+    void advanceStart(std::size_t n) {
+        if (n >= available()) {
+            // Emptied the buffer, so reset
+            _start = 0;
+            _end = 0;
+            return;
+        }
+
+        // Reads may cross the end of the buffer, but never go round twice
+        _start += n;
+        if (_start >= S) {
+            _start -= S;
+        }
+    }
+
+    // Counts n bytes stored at the position freeTogether() gave
+    void advanceEnd(std::size_t n) {
+        if (S == _end) {
+            _end = 0;
+        }
+        _end += n;
+    }
+
+    void retreatStart() {
+        if (0 == _start) {
+            _start = S;
+        }
+        --_start;
+    }
+
+    void clear() {
+        _start = 0;
+        _end = 0;
+    }
+};
+
+/*
+ * The same for power of two sizes. _head and _tail count every byte ever
+ * read and written, and only the low bits index the buffer, so the count is
+ * one subtraction and nothing needs to be special-cased at the end. The
+ * counters may overflow freely: S divides the range of size_t.
+ */
+template<std::size_t S>
+class RingBufferIndex<S, true>
+{
+private:
+    static const std::size_t MASK = S - 1;
+
+    std::size_t _head = 0;
+    std::size_t _tail = 0;
+
+    static std::size_t _min(std::size_t a, std::size_t b) {
+        return a < b ? a : b;
+    }
+
+public:
+    std::size_t available() const { return _tail - _head; }
+
+    std::size_t start() const { return _head & MASK; }
+
+    std::size_t freeTogether(std::size_t* pos) const {
+        *pos = _tail & MASK;
+        return _min(S - available(), S - *pos);
+    }
+
+    void advanceStart(std::size_t n) {
+        _head += _min(n, available());
+
+        // Once empty, start again from the front, so the next fill can be
+        // done in one block
+        if (_head == _tail) {
+            clear();
         }
+    }
+
+    void advanceEnd(std::size_t n) { _tail += n; }
+    void retreatStart() { --_head; }
+
+    void clear() {
+        _head = 0;
+        _tail = 0;
+    }
+};
+
+#ifndef ARDUINO
+/*
+ * Positions for a buffer shared by two threads: one producer, which only
+ * calls readFrom() and write(), and one consumer, which calls everything
+ * else except clear(). The producer publishes a whole block at a time with a
+ * release store of _tail, and the consumer frees space the same way through
+ * _head; each side acquires the other's counter.
+ *
+ * The counters are on separate cache lines. The producer also keeps the
+ * last _head it saw on its own line, and only reloads it when that is what
+ * limits a write, so it doesn't pull in the consumer's line every time.
+ *
+ * The consumer's count can grow between two calls to available(), so
+ * RingBuffer works from one count for the whole of each operation.
+ *
+ * putBack() is only safe for a byte the consumer has just read, while the
+ * producer can't have refilled its slot, i.e. the buffer wasn't full.
+ */
+template<std::size_t S>
+class SpscRingBufferIndex
+{
+    static_assert(0 == (S & (S - 1)), "S must be a power of two");
+
+private:
+    static const std::size_t MASK = S - 1;
+    static const std::size_t CACHE_LINE = 64;
 
-#       if 0
-        std::size_t count = instance.read(static_cast<void*>(&_buffer[p]),
-                                            static_cast<uint16_t>(n));
+    // The consumer's line
+    alignas(CACHE_LINE) std::atomic<std::size_t> _head;
 
-#       else
+    // The producer's line
+    alignas(CACHE_LINE) std::atomic<std::size_t> _tail;
+    mutable std::size_t _headSeen = 0;
+
+    static std::size_t _min(std::size_t a, std::size_t b) {
+        return a < b ? a : b;
+    }
+
+public:
+    SpscRingBufferIndex() : _head(0), _tail(0) {}
+
+    // Consumer side
+    std::size_t available() const {
+        return _tail.load(std::memory_order_acquire)
+            - _head.load(std::memory_order_relaxed);
+    }
+
+    std::size_t start() const {
+        return _head.load(std::memory_order_relaxed) & MASK;
+    }
+
+    void advanceStart(std::size_t n) {
+        n = _min(n, available());
+        _head.store(_head.load(std::memory_order_relaxed) + n,
+                    std::memory_order_release);
+    }
+
+    void retreatStart() {
+        _head.store(_head.load(std::memory_order_relaxed) - 1,
+                    std::memory_order_release);
+    }
+
+    // Producer side
+    std::size_t freeTogether(std::size_t* pos) const {
+        std::size_t tail = _tail.load(std::memory_order_relaxed);
+        *pos = tail & MASK;
+
+        std::size_t room = S - (tail - _headSeen);
+        if (room < S - *pos) {
+            // The consumer may have made more room since
+            _headSeen = _head.load(std::memory_order_acquire);
+            room = S - (tail - _headSeen);
+        }
+
+        return _min(room, S - *pos);
+    }
+
+    void advanceEnd(std::size_t n) {
+        _tail.store(_tail.load(std::memory_order_relaxed) + n,
+                    std::memory_order_release);
+    }
+
+    // Only while neither side is using the buffer
+    void clear() {
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+        _headSeen = 0;
+    }
+};
+#endif /* ARDUINO */
+
+/*
+ * Storage for a RingBuffer<S>: by default the S bytes are part of the
+ * buffer itself.
+ */
+template<std::size_t S>
+class RingBufferArray
+{
+private:
+    uint8_t _bytes[S];
+
+public:
+    uint8_t* data() { return _bytes; }
+    const uint8_t* data() const { return _bytes; }
+};
+
+/*
+ * Storage lent to the buffer for a while, such as a block from a
+ * BufferPool. Nothing may be read or written while none is attached.
+ */
+template<std::size_t S>
+class RingBufferBlock
+{
+private:
+    uint8_t* _bytes = NULL;
+
+public:
+    uint8_t* data() { return _bytes; }
+    const uint8_t* data() const { return _bytes; }
+
+    bool attached() const { return NULL != _bytes; }
+    void attach(uint8_t* bytes) { _bytes = bytes; }
+
+    uint8_t* detach() {
+        uint8_t* bytes = _bytes;
+        _bytes = NULL;
+        return bytes;
+    }
+};
+
+template<std::size_t S, typename I = RingBufferIndex<S>,
+            typename M = RingBufferArray<S> >
+class RingBuffer
+{
+private:
+    M _storage;
+    I _index;
+
+    uint8_t* _data() { return _storage.data(); }
+    const uint8_t* _data() const { return _storage.data(); }
+
+    void advanceStart(std::size_t n) { _index.advanceStart(n); }
+
+    // How many of avail bytes can be read before the end of the buffer
+    std::size_t availableTogether(std::size_t avail) const {
+        return _min(avail, S - _index.start());
+    }
+
+    std::size_t freeTogether(std::size_t* pos) const {
+        return _index.freeTogether(pos);
+    }
+
+    // Copies n bytes from the read position, crossing the end if needed
+    void copyOut(void* dest, std::size_t n) const {
+        std::size_t first = availableTogether(n);
+        memcpy(dest, &_data()[_index.start()], first);
+        memcpy(static_cast<uint8_t*>(dest) + first, _data(), n - first);
+    }
+
+    // find() over the first avail bytes
+    template<std::size_t K>
+    std::size_t find(const uint8_t (&terms)[K], std::size_t avail) const {
+        std::size_t first = availableTogether(avail);
+        const uint8_t* hit = byteScan(&_data()[_index.start()], first, terms);
+        if (NULL != hit) {
+            return hit - &_data()[_index.start()];
+        }
+
+        std::size_t second = avail - first;
+        hit = byteScan(_data(), second, terms);
+        return NULL == hit ? avail : first + (hit - _data());
+    }
+
+    template<typename U>
+    static U _min(U a, U b) { return a < b ? a : b; }
+
+    template<typename U>
+    static U _max(U a, U b) { return a > b ? a : b; }
+
+    template<bool B>
+    struct BulkTag {};
+
+    template<typename T>
+    std::size_t fill(T& instance, uint8_t* dest, std::size_t n, BulkTag<true>) {
+        if (n > UINT16_MAX) {
+            n = UINT16_MAX;
+        }
+
+        int count = instance.read(static_cast<void*>(dest),
+                                    static_cast<uint16_t>(n));
+
+        return 0 > count ? 0 : static_cast<std::size_t>(count);
+    }
+
+    template<typename T>
+    std::size_t fill(T& instance, uint8_t* dest, std::size_t n, BulkTag<false>) {
         std::size_t count = 0;
         int c;
 
@@ -99,62 +374,170 @@ public:
             if (0 > c) {
                 break;
             }
-            _buffer[count+p] = c;
+            dest[count] = c;
             count++;
         }
-#       endif
 
-        _end += count;
-        if (_end > S) {
-            _end %= S;
-        }
         return count;
     }
 
+public:
+    std::size_t capacity() const { return S; }
+    std::size_t available() const { return _index.available(); }
+
+    template<typename T>
+    std::size_t readFrom(T& instance) {
+        std::size_t total = 0;
+        std::size_t p;
+        std::size_t n;
+
+        // At most two passes: the tail segment, then the wrapped head segment
+        for (int ii = 0; ii < 2; ii++) {
+            n = freeTogether(&p);
+            if (0 == n) {
+                break; // No room
+            }
+
+            std::size_t count = fill(instance, &_data()[p], n,
+                                    BulkTag<RingBufferTraits<T>::bulkRead>());
+
+            _index.advanceEnd(count);
+            total += count;
+
+            if (count < n) {
+                break; // Source ran dry
+            }
+        }
+
+        return total;
+    }
+
+    // Copies as much of src as fits, returning the number of bytes taken
+    std::size_t write(const void* src, std::size_t n) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        std::size_t total = 0;
+        std::size_t p;
+
+        // At most two passes, like readFrom
+        for (int ii = 0; ii < 2 && total < n; ii++) {
+            std::size_t count = _min(freeTogether(&p), n - total);
+            if (0 == count) {
+                break; // Full
+            }
+
+            memcpy(&_data()[p], bytes + total, count);
+            _index.advanceEnd(count);
+            total += count;
+        }
+
+        return total;
+    }
+
+    // Hands the buffered bytes to instance.write(const void*, uint16_t)
+    template<typename T>
+    std::size_t writeTo(T& instance) {
+        std::size_t total = 0;
+
+        for (std::size_t avail = available(); 0 < avail; avail = available()) {
+            std::size_t n = _min(availableTogether(avail),
+                                static_cast<std::size_t>(UINT16_MAX));
+
+            std::size_t count = instance.write(
+                    static_cast<const void*>(&_data()[_index.start()]),
+                    static_cast<uint16_t>(n));
+
+            if (0 == count) {
+                break;
+            }
+
+            advanceStart(count);
+            total += count;
+
+            if (count < n) {
+                break; // Sink is full
+            }
+        }
+
+        return total;
+    }
+
     int read() {
         if (0 == available()) {
             return -1;
         }
 
-        uint8_t retval = _buffer[_start];
+        uint8_t retval = _data()[_index.start()];
         advanceStart(1);
         return retval;
     }
 
     std::size_t read(void* dest, std::size_t n) {
-        std::size_t len = availableTogether();
+        std::size_t len = availableTogether(available());
         n = _min(n, len);
 
         // Perform the copy
-        memcpy(dest, &_buffer[_start], n);
+        memcpy(dest, &_data()[_index.start()], n);
 
         advanceStart(n);
 
         return n;
     }
 
+    /*
+     * Offset from the read position of the first byte that is one of terms,
+     * or available() if there is none. Both segments are searched, and
+     * nothing is copied.
+     */
+    template<std::size_t K>
+    std::size_t find(const uint8_t (&terms)[K]) const {
+        return find(terms, available());
+    }
+
+    std::size_t find(uint8_t c) const {
+        const uint8_t terms[] = {c};
+        return find(terms);
+    }
+
+    // Reads up to and including c, or n bytes, whichever comes first
     std::size_t readUntil(void* dest, uint8_t c, std::size_t n) {
-        // Calculate number of linear available bytes
-        std::size_t len = availableTogether();
+        const uint8_t terms[] = {c};
+        std::size_t avail = available();
+        std::size_t count = _min(find(terms, avail) + 1, _min(n, avail));
 
-        // Take the min of the number of available bytes, and the size of dest
-        n = _min(n, len);
+        copyOut(dest, count);
+        advanceStart(count);
 
-        // Perform the copy
-        uint8_t* pos = static_cast<uint8_t*>(memccpy(dest, &_buffer[_start], c,
-                                                        n));
+        return count;
+    }
 
-        // Figure out how many bytes were copied
-        std::size_t count;
-        if (NULL == pos) {
-            count = n;
-        } else {
-            count = pos - static_cast<uint8_t*>(dest);
+    /*
+     * The buffered bytes in order, without copying them: one span, or two
+     * when they wrap around the end. Returns the number of spans filled in.
+     * Nothing is removed until consume().
+     */
+    std::size_t peekSpans(RingBufferSpan (&spans)[2]) const {
+        std::size_t avail = available();
+        std::size_t first = availableTogether(avail);
+        if (0 == first) {
+            return 0;
         }
 
-        advanceStart(count);
+        spans[0].data = &_data()[_index.start()];
+        spans[0].length = first;
 
-        return count;
+        std::size_t second = avail - first;
+        if (0 == second) {
+            return 1;
+        }
+
+        spans[1].data = _data();
+        spans[1].length = second;
+        return 2;
+    }
+
+    // Drops n bytes from the front, once they've been used in place
+    void consume(std::size_t n) {
+        advanceStart(n);
     }
 
     int peek() {
@@ -162,21 +545,47 @@ public:
             return -1;
         }
 
-        return _buffer[_start];
+        return _data()[_index.start()];
     }
 
-    void putBack(uint8_t c) {
-        if (0 == _start) {
-            _start = S;
+    /*
+     * Returns c to the front, normally a byte that was just read. A full
+     * buffer has nowhere to put it, so it's refused rather than written
+     * over the last byte.
+     */
+    bool putBack(uint8_t c) {
+        if (S == available()) {
+            return false;
         }
 
-        _buffer[--_start] = c;
+        _index.retreatStart();
+        _data()[_index.start()] = c;
+        return true;
     }
 
     void clear() {
-        _start = 0;
-        _end = 0;
+        _index.clear();
+    }
+
+    // Only for RingBufferBlock storage
+    bool attached() const { return _storage.attached(); }
+    void attach(uint8_t* block) { _storage.attach(block); }
+
+    // Hands the block back, which has to be empty
+    uint8_t* detach() {
+        _index.clear();
+        return _storage.detach();
     }
 };
 
+// A RingBuffer whose bytes are only there while a block is attached
+template<std::size_t S>
+using PooledRingBuffer = RingBuffer<S, RingBufferIndex<S>, RingBufferBlock<S> >;
+
+#ifndef ARDUINO
+// A RingBuffer that one thread can fill while another drains it
+template<std::size_t S>
+using SpscRingBuffer = RingBuffer<S, SpscRingBufferIndex<S> >;
+#endif
+
 #endif
@@ -0,0 +1,100 @@
+#ifdef ARDUINO
+#include "SDFile.h"
+#include "FNV1a.h"
+
+/*
+ * The SD library doesn't give out modification times, so the tag is a hash
+ * of the whole file. Anything less lets an edit keep the tag, and clients
+ * would be told their stale copy is current. Files on the card only change
+ * when it's swapped, which restarts the sketch, or when the sketch writes
+ * them, so the last few tags are kept by path and size; see changed().
+ */
+struct SDFileTag
+{
+    uint32_t path;              // FNV-1a of the path
+    uint32_t size;
+    uint32_t tag;
+};
+
+static SDFileTag tags[SDFILE_TAG_CACHE];
+static uint8_t tagCount = 0;
+static uint8_t tagNext = 0;     // Once they're all used, the one to replace
+
+static uint32_t pathHash(const char* path)
+{
+    return fnv1a(FNV_OFFSET, reinterpret_cast<const uint8_t*>(path),
+                 strlen(path));
+}
+
+bool SDFile::open(const char* path)
+{
+    close();
+
+    _file = SD.open(path, FILE_READ);
+    if (!_file) {
+        return false;
+    } else if (_file.isDirectory()) {
+        close();
+        return false;
+    }
+
+    uint32_t h = pathHash(path);
+    uint32_t size = _file.size();
+    for (uint8_t ii = 0; ii < tagCount; ii++) {
+        if (h == tags[ii].path && size == tags[ii].size) {
+            _tag = tags[ii].tag;
+            return true;
+        }
+    }
+
+    uint8_t block[64];
+    _tag = FNV_OFFSET;
+    for (int r; 0 < (r = _file.read(block, sizeof(block))); ) {
+        _tag = fnv1a(_tag, block, r);
+    }
+    _file.seek(0);
+
+    SDFileTag* entry;
+    if (tagCount < SDFILE_TAG_CACHE) {
+        entry = &tags[tagCount++];
+    } else {
+        entry = &tags[tagNext];
+        tagNext = (tagNext + 1) % SDFILE_TAG_CACHE;
+    }
+    entry->path = h;
+    entry->size = size;
+    entry->tag = _tag;
+
+    return true;
+}
+
+void SDFile::changed(const char* path)
+{
+    uint32_t h = pathHash(path);
+    for (uint8_t ii = 0; ii < tagCount; ) {
+        if (h == tags[ii].path) {
+            tags[ii] = tags[--tagCount];
+        } else {
+            ii++;
+        }
+    }
+}
+
+void SDFile::close()
+{
+    if (_file) {
+        _file.close();
+    }
+}
+
+bool SDFile::size(size_type* n)
+{
+    if (!_file) {
+        return false;
+    }
+
+    *n = _file.size();
+    return true;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,49 @@
+#ifndef SDFILE_H
+#define SDFILE_H
+
+/*
+ * Device file source, on an SD card through the Arduino SD library. The
+ * card has to have been started with SD.begin() first.
+ */
+#include <SD.h>
+
+/*
+ * Tags are hashes of the whole file, which takes a read of all of it, so
+ * those of this many files are kept for the next time they're opened.
+ */
+#ifndef SDFILE_TAG_CACHE
+#   define SDFILE_TAG_CACHE 4
+#endif
+
+class SDFile
+{
+private:
+    File _file;
+    uint32_t _tag = 0;
+
+public:
+    typedef uint32_t size_type;
+
+    SDFile() = default;
+    SDFile(const SDFile&) = delete;
+    SDFile& operator=(const SDFile&) = delete;
+    ~SDFile() { close(); }
+
+    // Fails for directories, which the SD library opens like files
+    bool open(const char* path);
+    bool isOpen() { return _file; }
+    void close();
+
+    bool size(size_type* n);
+    uint32_t tag() const { return _tag; }
+
+    int read(uint8_t* buf, size_t n) { return _file.read(buf, n); }
+
+    /*
+     * A sketch that rewrites a file without changing its size has to call
+     * this, or the file keeps the tag it had.
+     */
+    static void changed(const char* path);
+};
+
+#endif /* SDFILE_H */
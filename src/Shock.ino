@@ -19,55 +19,185 @@
 // Security can be WLAN_SEC_UNSEC, WLAN_SEC_WEP, WLAN_SEC_WPA or WLAN_SEC_WPA2
 #define WLAN_SECURITY   WLAN_SEC_WPA2
 
+// Paths the sketch answers, matched while the request line streams in
+constexpr const char* const ROUTES[] = {"/", "/ram"};
+static const StringComparator routes = STRING_COMPARATOR(ROUTES);
+static const http_methods methods[] = {
+    HTTPMethodBit(http_method::GET) | HTTPMethodBit(http_method::HEAD),
+    HTTPMethodBit(http_method::GET),
+};
+
 class My_HTTP_Client : public HTTP_Client
 {
     friend class My_HTTP_Server;
-    using HTTP_Client::HTTP_Client;
+public:
+    My_HTTP_Client() : HTTP_Client(routes, methods) {}
+
 private:
     http_request_state old_state = http_request_state::DONE;
 
-    void reportError(http_status e) {
-        if (responseState() == http_response_state::VERSION) {
-            write(F("HTTP/1.0"));
-            advanceTo(http_response_state::STATUS_CODE);
+    /*
+     * A response goes out a part at a time: a string, or a move to the next
+     * response state. What a backed-up connection doesn't take is written
+     * by a later process(), which runs the response again from the top,
+     * skipping the parts that are already out.
+     */
+    bool _responding = false;
+    http_status _error = http_status::OKAY;
+    size_t _partsOut = 0;       // Parts the connection has taken
+    size_t _partOffset = 0;     // Bytes of the next part it has taken
+    size_t _part = 0;           // The part this run of the response is at
+    char _ram[8];               // Free RAM when the response started
+
+    static const __FlashStringHelper* statusCode(http_status e) {
+        switch (e) {
+            case http_status::FAIL_BAD_REQUEST:
+                return F("400");
+            case http_status::FAIL_METHOD_NOT_ALLOWED:
+                return F("405");
+            case http_status::FAIL_TIMEOUT:
+                return F("408");
+            case http_status::FAIL_UNSUPPORTED:
+                return F("501");
+            default:
+                return F("500");
         }
+    }
 
-        if (responseState() == http_response_state::STATUS_CODE) {
-            switch (e) {
-                case http_status::FAIL_BAD_REQUEST:
-                    write(F("400"));
-                    break;
-                default:
-                    write(F("500"));
-                    break;
-            }
-            advanceTo(http_response_state::STATUS_REASON);
+    // Whether the part is out, asking for a later process() if it isn't
+    bool wrote(bool all) {
+        if (!all) {
+            resume();
+            return false;
+        }
+        _partsOut++;
+        _partOffset = 0;
+        return true;
+    }
+
+    bool part(const __FlashStringHelper* str) {
+        if (_part++ < _partsOut) {
+            return true;
+        }
+        const char* p = reinterpret_cast<const char*>(str);
+        _partOffset += write(F(p + _partOffset));
+        return wrote(0 == pgm_read_byte(p + _partOffset));
+    }
+
+    bool part(const char* str) {
+        if (_part++ < _partsOut) {
+            return true;
+        }
+        _partOffset += write(str + _partOffset);
+        return wrote(0 == str[_partOffset]);
+    }
+
+    bool part(http_response_state state) {
+        if (_part++ < _partsOut) {
+            return true;
+        }
+        http_status status = advanceTo(state);
+        if (http_status::INCOMPLETE == status) {
+            return false;           // advanceTo() has asked to resume
+        } else if (http_status::OKAY != status) {
+            _responding = false;
+            close();
+            return false;
+        }
+        return wrote(true);
+    }
+
+    void start(http_status error) {
+        _responding = true;
+        _error = error;
+        _partsOut = 0;
+        _partOffset = 0;
+        respond();
+    }
+
+    void respond() {
+        _part = 0;
+        if (http_status::OKAY != _error) {
+            reportError();
+            return;
         }
 
-        if (responseState() == http_response_state::STATUS_REASON) {
-            write(HTTPStatusToString(e));
-            advanceTo(http_response_state::HEADER_NAME);
+        if (!part(http_version::HTTP_1_1 == version() ? F("HTTP/1.1")
+                                                      : F("HTTP/1.0"))
+                || !part(http_response_state::STATUS_CODE)) {
+            return;
         }
 
-        if (responseState() == http_response_state::HEADER_NAME) {
-            write(F("Content-Length"));
-            advanceTo(http_response_state::HEADER_VALUE);
+        size_t idx;
+        if (!route(idx)) {
+            if (!part(F("404"))
+                    || !part(http_response_state::STATUS_REASON)
+                    || !part(F("Not Found"))
+                    || !part(http_response_state::HEADER_NAME)
+                    || !part(F("Content-Length"))
+                    || !part(http_response_state::HEADER_VALUE)
+                    || !part(F("0"))
+                    || !part(http_response_state::BODY)) {
+                return;
+            }
+        } else {
+            if (!part(F("200"))
+                    || !part(http_response_state::STATUS_REASON)
+                    || !part(F("OK"))) {
+                return;
+            }
+            if (!keepAlive()
+                    && (!part(http_response_state::HEADER_NAME)
+                        || !part(F("Connection"))
+                        || !part(http_response_state::HEADER_VALUE)
+                        || !part(F("close")))) {
+                return;
+            }
+            if (!part(http_response_state::BODY)
+                    || !(1 == idx ? part(_ram) : part(F("Hello World")))) {
+                return;
+            }
         }
 
-        if (responseState() == http_response_state::HEADER_VALUE) {
-            write('0');
-            advanceTo(http_response_state::BODY);
+        _responding = false;
+        complete();
+    }
+
+    void reportError() {
+        if (!part(F("HTTP/1.0"))
+                || !part(http_response_state::STATUS_CODE)
+                || !part(statusCode(_error))
+                || !part(http_response_state::STATUS_REASON)
+                || !part(HTTPStatusToString(_error))
+                || !part(http_response_state::HEADER_NAME)
+                || !part(F("Content-Length"))
+                || !part(http_response_state::HEADER_VALUE)
+                || !part(F("0"))
+                || !part(http_response_state::BODY)) {
+            return;
         }
+
+        _responding = false;
+        close();
     }
 
 protected:
     virtual void process() override
     {
-        uint8_t buf[65];
-        std::size_t n_buf = 64;
+        // The rest of a response the connection was backed up for; a new
+        // connection, which hasn't sent anything, drops any that was left
+        if (_responding && 0 < flushes()) {
+            respond();
+            return;
+        }
+        _responding = false;
+
+        // Printed straight from the receive buffer, no copy needed
+        const uint8_t* data;
+        std::size_t n_data = 64;
 
         http_request_state state;
-        http_status status = read(buf, &n_buf, &state);
+        http_status status = read(&data, &n_data, &state);
 
         if (old_state != state) {
             old_state = state;
@@ -78,56 +208,30 @@ protected:
             Serial.print(F(": "));
         }
 
-        buf[n_buf] = '\0';
-
         switch (status) {
         case http_status::INCOMPLETE:
         case http_status::OKAY:
-            if (n_buf > 1) {
-                Serial.print(reinterpret_cast<char*>(buf));
-            } else if (n_buf == 1) {
+            if (n_data > 1) {
+                Serial.write(data, n_data);
+            } else if (n_data == 1) {
                 Serial.print("<");
-                Serial.print(buf[0], HEX);
+                Serial.print(data[0], HEX);
                 Serial.print("> ");
             }
             break;
         default:
             Serial.println(HTTPStatusToString(status));
-            reportError(status);
-            break;
+            start(status);
+            return;
         }
 
-        if (http_status::OKAY == status) {
-            switch (state) {
-                case http_request_state::VERSION:
-                    switch (version()) {
-                        case http_version::HTTP_1_1:
-                            write(F("HTTP/1.1"));
-                            break;
-                        case http_version::HTTP_1_0:
-                        default:
-                            write(F("HTTP/1.0"));
-                            break;
-                    }
-                    advanceTo(http_response_state::STATUS_CODE);
-                    break;
-                case http_request_state::BODY:
-                    write(F("200"));
-                    advanceTo(http_response_state::STATUS_REASON);
-                    write(F("OK"));
-                    advanceTo(http_response_state::HEADER_NAME);
-                    write(F("Content-Length"));
-                    advanceTo(http_response_state::HEADER_VALUE);
-                    write(F("11"));
-                    advanceTo(http_response_state::HEADER_NAME);
-                    write(F("Connection"));
-                    advanceTo(http_response_state::HEADER_VALUE);
-                    write(F("close"));
-                    advanceTo(http_response_state::BODY);
-                    write(F("Hello World"));
-                    close();
-                    break;
+        if (http_status::OKAY == status && http_request_state::BODY == state) {
+            size_t idx;
+            if (route(idx)) {
+                chunked();
+                snprintf(_ram, sizeof(_ram), "%d", getFreeRam());
             }
+            start(http_status::OKAY);
         }
     }
 };
@@ -136,7 +240,7 @@ class My_HTTP_Server : public HTTP_Server
 {
     using HTTP_Server::HTTP_Server;
 private:
-    My_HTTP_Client _clients[MAX_SERVER_CLIENTS];
+    My_HTTP_Client _clients[HTTP_MAX_CLIENTS];
 
 protected:
     virtual HTTP_Client& client(size_t idx) override
@@ -3,48 +3,376 @@
 
 #include <stdlib.h>
 #include <stdint.h>
-#include <WString.h>
+#include "Platform.h"
 
+/*
+ * Recognises one of a fixed set of strings, one table step per input byte no
+ * matter how many strings there are. The tables are a DFA over the trie of
+ * the strings, generated at compile time by StringDfa:
+ *
+ *     constexpr const char* const NAMES[] = {"Host", "Connection"};
+ *     StringComparator names = STRING_COMPARATOR(NAMES);
+ *
+ * Bytes are first mapped to a character class (one per distinct byte in the
+ * strings, plus one for everything else), so a table row is only as wide as
+ * the alphabet actually used. STRING_COMPARATOR_NOCASE puts both cases of a
+ * letter in the same class.
+ */
 class StringComparator;
 
 class StringComparison
 {
     friend class StringComparator;
 private:
-    const StringComparator* _parent;
-    bool* _invalid;
-    size_t _count = 0;
+    const StringComparator* _parent = NULL;
+    uint8_t _state = 0;
 
-    explicit StringComparison(const StringComparator* parent);
+    explicit StringComparison(const StringComparator* parent)
+        : _parent(parent) {}
 
 public:
     StringComparison() = default;
-    StringComparison(const StringComparison&) = delete; // Copy constructor
-    StringComparison(StringComparison&&);
 
-    StringComparison& operator=(const StringComparison&) = delete; // Assignment
-    StringComparison& operator=(StringComparison&&);
-
-    void reset();
+    void reset() { _state = 0; }
     void next(uint8_t c);
     bool hasMatch(size_t& idx) const;
-
-    ~StringComparison();
 };
 
 class StringComparator
 {
     friend class StringComparison;
 private:
-    const char** _strings;
-    const size_t _n_strings;
+    const uint8_t* _classes;        // Byte to character class, 256 entries
+    const uint8_t* _transitions;    // State by character class
+    const uint8_t* _accepts;        // String index + 1 per state, or 0
+    uint8_t _n_classes;
+
+public:
+    StringComparator(const uint8_t* classes, const uint8_t* transitions,
+                        const uint8_t* accepts, uint8_t n_classes)
+        : _classes(classes), _transitions(transitions), _accepts(accepts),
+          _n_classes(n_classes) {}
+
+    StringComparison create() const { return StringComparison(this); }
+};
+
+inline void StringComparison::next(uint8_t c)
+{
+    if (NULL == _parent) {
+        return;
+    }
+
+    uint8_t cls = pgm_read_byte(_parent->_classes + c);
+    _state = pgm_read_byte(_parent->_transitions
+                            + _state * _parent->_n_classes + cls);
+}
+
+inline bool StringComparison::hasMatch(size_t& idx) const
+{
+    if (NULL == _parent) {
+        return false;
+    }
+
+    uint8_t accept = pgm_read_byte(_parent->_accepts + _state);
+    if (0 == accept) {
+        return false;
+    }
+
+    idx = accept - 1;
+    return true;
+}
+
+/*****************************************************************************
+ * Compile-time table generation                                             *
+ *****************************************************************************/
+template<size_t... I>
+struct index_list {};
+
+template<typename A, typename B>
+struct concat_index_list;
+
+template<size_t... A, size_t... B>
+struct concat_index_list<index_list<A...>, index_list<B...> >
+{
+    typedef index_list<A..., (sizeof...(A) + B)...> type;
+};
+
+// Built by halves, so long lists don't hit the template depth limit
+template<size_t N>
+struct make_index_list
+{
+    typedef typename concat_index_list<
+        typename make_index_list<N / 2>::type,
+        typename make_index_list<N - N / 2>::type>::type type;
+};
+
+template<>
+struct make_index_list<0>
+{
+    typedef index_list<> type;
+};
+
+template<>
+struct make_index_list<1>
+{
+    typedef index_list<0> type;
+};
+
+template<typename D, typename L>
+struct StringDfaValues;
+
+// D::entry() for every index, for use by the compiler while building tables
+template<typename D, size_t... I>
+struct StringDfaValues<D, index_list<I...> >
+{
+    static constexpr size_t data[sizeof...(I)] = {D::entry(I)...};
+};
+
+template<typename D, size_t... I>
+constexpr size_t StringDfaValues<D, index_list<I...> >::data[sizeof...(I)];
+
+template<typename D, typename L>
+struct StringDfaTable;
+
+// D::entry() for every index, as a table in program memory
+template<typename D, size_t... I>
+struct StringDfaTable<D, index_list<I...> >
+{
+    static const uint8_t data[sizeof...(I)];
+};
+
+template<typename D, size_t... I>
+const uint8_t StringDfaTable<D, index_list<I...> >::data[sizeof...(I)] PROGMEM
+    = {D::entry(I)...};
+
+/*
+ * Compile-time helpers for StringDfa, over the N strings at S. They are split
+ * over a few structs because a class's static constexpr members can only use
+ * constexpr functions from classes that are already complete.
+ *
+ * All the functions are single-return recursions to stay within C++11
+ * constexpr. Anything needed for every table entry is computed once into a
+ * StringDfaValues array, or the compiler spends minutes redoing it.
+ */
+template<const char* const* S, size_t N, bool F>
+struct StringDfaStrings
+{
+    // With F, upper case letters are treated as their lower case
+    static constexpr uint8_t fold(uint8_t c) {
+        return F && c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
 
-    uint8_t charAt(size_t idx, size_t pos) const;
+    static constexpr size_t length(const char* s, size_t i = 0) {
+        return 0 == s[i] ? i : length(s, i + 1);
+    }
+
+    static constexpr size_t maxLength(size_t j = 0, size_t longest = 0) {
+        return j == N ? longest
+            : maxLength(j + 1, length(S[j]) > longest ? length(S[j]) : longest);
+    }
+
+    static constexpr bool contains(const char* s, uint8_t c, size_t i = 0) {
+        return 0 != s[i] && (fold(s[i]) == c || contains(s, c, i + 1));
+    }
+
+    static constexpr bool used(uint8_t c, size_t j = 0) {
+        return j < N && (contains(S[j], c) || used(c, j + 1));
+    }
+
+    static constexpr bool samePrefix(const char* a, const char* b, size_t L,
+                                        size_t i = 0) {
+        return i == L
+            || (fold(a[i]) == fold(b[i]) && samePrefix(a, b, L, i + 1));
+    }
+
+    static constexpr size_t firstWithPrefix(size_t k, size_t L, size_t j = 0) {
+        return j == k || samePrefix(S[j], S[k], L) ? j
+            : firstWithPrefix(k, L, j + 1);
+    }
+
+    // Lowest string that has string k's first L bytes followed by c, or N
+    static constexpr size_t firstWithNext(size_t k, size_t L, uint8_t c,
+                                            size_t j = 0) {
+        return j == N ? N
+            : samePrefix(S[j], S[k], L) && fold(S[j][L]) == c
+                ? j
+                : firstWithNext(k, L, c, j + 1);
+    }
+
+    static constexpr size_t WIDTH = maxLength() + 1;
+    static constexpr size_t PAIRS = N * WIDTH;
+
+    /*
+     * A trie node is named by a pair (k, L): the first L bytes of string k,
+     * where k is the lowest index of any string with that prefix. Pairs are
+     * numbered k * WIDTH + L.
+     */
+    static constexpr bool isNode(size_t p) {
+        return p % WIDTH <= length(S[p / WIDTH])
+            && firstWithPrefix(p / WIDTH, p % WIDTH) == p / WIDTH;
+    }
+
+    // Only folded bytes get a class of their own
+    struct Used
+    {
+        static constexpr size_t entry(size_t c) {
+            return 0 != c && fold(c) == c && used(c) ? 1 : 0;
+        }
+    };
+
+    struct Nodes
+    {
+        static constexpr size_t entry(size_t p) {
+            return isNode(p) ? 1 : 0;
+        }
+    };
+};
+
+// Running totals of the values in V: entry(i) is the sum of V::data[0, i)
+template<typename V>
+struct StringDfaSums
+{
+    static constexpr size_t sum(size_t lo, size_t hi) {
+        return hi <= lo ? 0
+            : hi - lo == 1 ? V::data[lo]
+            : sum(lo, (lo + hi) / 2) + sum((lo + hi) / 2, hi);
+    }
+
+    static constexpr size_t entry(size_t i) {
+        return sum(0, i);
+    }
+};
+
+template<const char* const* S, size_t N, bool F>
+struct StringDfaTrie
+{
+    typedef StringDfaStrings<S, N, F> Strings;
+
+    typedef StringDfaValues<typename Strings::Used,
+                            typename make_index_list<256>::type> Used;
+    typedef StringDfaValues<typename Strings::Nodes,
+                            typename make_index_list<Strings::PAIRS>::type> Nodes;
+
+    // Bytes that appear in the strings below c, and nodes below pair p
+    typedef StringDfaValues<StringDfaSums<Used>,
+                            typename make_index_list<257>::type> UsedBefore;
+    typedef StringDfaValues<StringDfaSums<Nodes>,
+                    typename make_index_list<Strings::PAIRS + 1>::type> NodesBefore;
+
+    // Class 0 is every byte that appears in no string. When folding, both
+    // cases of a letter share a class, so matching costs nothing extra.
+    static constexpr uint8_t classOf(size_t c) {
+        return Used::data[Strings::fold(c)]
+            ? 1 + UsedBefore::data[Strings::fold(c)] : 0;
+    }
+
+    // The byte in class cls, by binary search
+    static constexpr uint8_t byteOf(size_t cls, size_t lo = 1, size_t hi = 256) {
+        return hi - lo <= 1 ? lo
+            : UsedBefore::data[(lo + hi) / 2] >= cls
+                ? byteOf(cls, lo, (lo + hi) / 2)
+                : byteOf(cls, (lo + hi) / 2, hi);
+    }
+
+    // The pair of a node, by binary search
+    static constexpr size_t pairOf(size_t node, size_t lo = 0,
+                                    size_t hi = Strings::PAIRS) {
+        return hi - lo <= 1 ? lo
+            : NodesBefore::data[(lo + hi) / 2] > node
+                ? pairOf(node, lo, (lo + hi) / 2)
+                : pairOf(node, (lo + hi) / 2, hi);
+    }
+
+    // Lowest string extending node's prefix with c, or N
+    static constexpr size_t extend(size_t node, uint8_t c) {
+        return Strings::firstWithNext(pairOf(node) / Strings::WIDTH,
+                                        pairOf(node) % Strings::WIDTH, c);
+    }
+
+    // The node one byte past node along string j
+    static constexpr size_t child(size_t node, size_t j) {
+        return NodesBefore::data[j * Strings::WIDTH
+                                    + pairOf(node) % Strings::WIDTH + 1];
+    }
+};
+
+/*
+ * The DFA for the N strings at S. S must be a constexpr array, so the
+ * strings themselves are only read by the compiler. The states are the trie
+ * nodes, root first, plus DEAD, which absorbs any input that can no longer
+ * match. With F, ASCII letters match in either case.
+ */
+template<const char* const* S, size_t N, bool F = false>
+class StringDfa
+{
+private:
+    typedef StringDfaStrings<S, N, F> Strings;
+    typedef StringDfaTrie<S, N, F> Trie;
 
 public:
-    StringComparator(const char** strings, size_t n);
+    static constexpr size_t CLASSES = 1 + Trie::UsedBefore::data[256];
+    static constexpr size_t DEAD = Trie::NodesBefore::data[Strings::PAIRS];
+    static constexpr size_t STATES = DEAD + 1;
+
+    static_assert(STATES <= 256, "too many states for uint8_t");
+
+    struct Classes
+    {
+        static constexpr uint8_t entry(size_t c) {
+            return Trie::classOf(c);
+        }
+    };
 
-    StringComparison create();
+    struct Transitions
+    {
+        static constexpr uint8_t next(size_t node, size_t j) {
+            return N == j ? DEAD : Trie::child(node, j);
+        }
+
+        static constexpr uint8_t entry(size_t e) {
+            return DEAD == e / CLASSES || 0 == e % CLASSES ? DEAD
+                : next(e / CLASSES,
+                       Trie::extend(e / CLASSES, Trie::byteOf(e % CLASSES)));
+        }
+    };
+
+    struct Accepts
+    {
+        static constexpr uint8_t accept(size_t j) {
+            return N == j ? 0 : j + 1;
+        }
+
+        // A string ends at this node if it continues with its terminator
+        static constexpr uint8_t entry(size_t state) {
+            return DEAD == state ? 0 : accept(Trie::extend(state, 0));
+        }
+    };
+
+    static StringComparator comparator() {
+        return StringComparator(
+            StringDfaTable<Classes, make_index_list<256>::type>::data,
+            StringDfaTable<Transitions,
+                            typename make_index_list<STATES * CLASSES>::type>::data,
+            StringDfaTable<Accepts,
+                            typename make_index_list<STATES>::type>::data,
+            CLASSES);
+    }
 };
 
+template<const char* const* S, size_t N, bool F>
+constexpr size_t StringDfa<S, N, F>::CLASSES;
+
+template<const char* const* S, size_t N, bool F>
+constexpr size_t StringDfa<S, N, F>::DEAD;
+
+template<const char* const* S, size_t N, bool F>
+constexpr size_t StringDfa<S, N, F>::STATES;
+
+#define STRING_COMPARATOR(strings) \
+    StringDfa<strings, sizeof(strings) / sizeof(strings[0])>::comparator()
+
+// Like STRING_COMPARATOR, but ignoring the case of ASCII letters
+#define STRING_COMPARATOR_NOCASE(strings) \
+    StringDfa<strings, sizeof(strings) / sizeof(strings[0]), true>::comparator()
+
 #endif /* STRINGCOMPARATOR_H */
@@ -0,0 +1,135 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#ifdef ARDUINO
+#   include <stdlib.h>
+#   include <stdint.h>
+    namespace std
+    {
+        typedef ::size_t size_t;
+    }
+#else
+#   include <cstdint>
+#   include <cstdlib>
+#endif
+
+/*
+ * One deadline for each of N items, in milliseconds as millis() counts them.
+ * Deadlines are hashed into SLOTS lists by the RESOLUTION-long interval they
+ * fall in, so expire() only looks at the items in the intervals that have
+ * passed since it was last called, not at every item.
+ *
+ * A deadline more than a turn of the wheel away shares its list with nearer
+ * ones, and is skipped until its turn comes. SLOTS and RESOLUTION are powers
+ * of two so the slots line up again when millis() wraps.
+ */
+template<std::size_t N, std::size_t SLOTS, unsigned long RESOLUTION>
+class TimerWheel
+{
+    static_assert(0 == (SLOTS & (SLOTS - 1)), "SLOTS must be a power of two");
+    static_assert(0 == (RESOLUTION & (RESOLUTION - 1)),
+                    "RESOLUTION must be a power of two");
+
+private:
+    static const std::size_t NONE = N;
+
+    std::size_t _heads[SLOTS];
+
+    // Each item's list links, and its slot (SLOTS when it isn't scheduled)
+    std::size_t _next[N];
+    std::size_t _prev[N];
+    std::size_t _slots[N];
+    unsigned long _deadlines[N];
+
+    // Start of the interval expire() has got up to
+    unsigned long _now = 0;
+
+    static bool reached(unsigned long now, unsigned long when) {
+        return 0 <= static_cast<long>(now - when);
+    }
+
+    static std::size_t slot(unsigned long when) {
+        return (when / RESOLUTION) % SLOTS;
+    }
+
+    void unlink(std::size_t idx) {
+        if (NONE != _prev[idx]) {
+            _next[_prev[idx]] = _next[idx];
+        } else {
+            _heads[_slots[idx]] = _next[idx];
+        }
+
+        if (NONE != _next[idx]) {
+            _prev[_next[idx]] = _prev[idx];
+        }
+
+        _slots[idx] = SLOTS;
+    }
+
+public:
+    TimerWheel() {
+        for (std::size_t ii = 0; ii < SLOTS; ii++) {
+            _heads[ii] = NONE;
+        }
+        for (std::size_t ii = 0; ii < N; ii++) {
+            _slots[ii] = SLOTS;
+        }
+    }
+
+    bool scheduled(std::size_t idx) const { return SLOTS != _slots[idx]; }
+    unsigned long deadline(std::size_t idx) const { return _deadlines[idx]; }
+
+    // Replaces any deadline idx already had
+    void schedule(std::size_t idx, unsigned long when) {
+        cancel(idx);
+
+        // Somewhere expire() will still look, if it's already passed
+        std::size_t s = slot(reached(_now, when) ? _now : when);
+
+        _deadlines[idx] = when;
+        _slots[idx] = s;
+        _prev[idx] = NONE;
+        _next[idx] = _heads[s];
+        if (NONE != _heads[s]) {
+            _prev[_heads[s]] = idx;
+        }
+        _heads[s] = idx;
+    }
+
+    void cancel(std::size_t idx) {
+        if (scheduled(idx)) {
+            unlink(idx);
+        }
+    }
+
+    /*
+     * An item whose deadline is at or before now, which is no longer
+     * scheduled; or N once there are none. Call it until it returns N.
+     */
+    std::size_t expire(unsigned long now) {
+        unsigned long current = now - now % RESOLUTION;
+
+        // Any further behind and every slot would be looked at twice
+        if (static_cast<long>(current - _now)
+                >= static_cast<long>(SLOTS * RESOLUTION)) {
+            _now = current - (SLOTS - 1) * RESOLUTION;
+        }
+
+        for (;;) {
+            for (std::size_t idx = _heads[slot(_now)]; NONE != idx;
+                    idx = _next[idx]) {
+                if (reached(now, _deadlines[idx])) {
+                    unlink(idx);
+                    return idx;
+                }
+            }
+
+            if (reached(_now, current)) {
+                return NONE;
+            }
+            _now += RESOLUTION;
+        }
+    }
+};
+
+#endif /* TIMERWHEEL_H */
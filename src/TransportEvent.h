@@ -0,0 +1,24 @@
+#ifndef TRANSPORTEVENT_H
+#define TRANSPORTEVENT_H
+
+#include <stddef.h>
+
+/*
+ * Readiness reported by a transport's poll(). HTTP_Server only touches the
+ * clients named in these events, instead of visiting every slot each tick.
+ */
+enum class transport_event
+{
+    CONNECTED,      // A new connection was accepted into the slot
+    DISCONNECTED,   // The slot's connection was closed, by either side
+    READABLE,       // Input (or end of input) is waiting to be read
+    WRITABLE,       // Output can be written, see notifyWritable()
+};
+
+struct TransportEvent
+{
+    size_t index;
+    transport_event type;
+};
+
+#endif /* TRANSPORTEVENT_H */
@@ -0,0 +1,62 @@
+/*
+ * Timings that only mean something in an optimized build, kept out of the
+ * unit tests. Build the shockbench target (-O2) and run it:
+ *
+ *     shockbench
+ */
+#include "RingBuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__i386__) || defined(__x86_64__)
+#   include <x86intrin.h>
+#else
+#   include <chrono>
+#endif
+
+// Time stamp counter, or nanoseconds where there isn't one
+static uint64_t cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Cycles per byte through peek() and read(), the way the parser steps
+// through chunk framing, which is mostly index arithmetic
+template<typename B>
+static double cyclesPerByte()
+{
+    static B a;
+    uint8_t buffer[64] = {0};
+    const size_t rounds = 1000000;
+    size_t total = 0;
+
+    uint64_t start = cycles();
+    for (size_t ii = 0; ii < rounds; ii++) {
+        size_t n = a.write(buffer, 37 + ii % 27);
+        for (size_t jj = 0; jj < n; jj++) {
+            if (0 <= a.peek() && 0 <= a.read()) {
+                total++;
+            }
+        }
+    }
+    uint64_t elapsed = cycles() - start;
+
+    return static_cast<double>(elapsed) / total;
+}
+
+int main()
+{
+    // The power-of-two size masks its indices instead of comparing them
+    double general = cyclesPerByte<RingBuffer<1000> >();
+    double masked = cyclesPerByte<RingBuffer<1024> >();
+
+    printf("RingBuffer<1000>: %.2f cycles/byte\n", general);
+    printf("RingBuffer<1024>: %.2f cycles/byte\n", masked);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Host build of the Shock sample server. Runs the same HTTP_Server state
+ * machine as the sketch on top of POSIX sockets, so it can be pointed at
+ * regular HTTP load generators:
+ *
+ *     shockhost 8080 &
+ *     wrk -c 4 -d 10s http://localhost:8080/
+ */
+#include "HTTP_Server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+class Host_HTTP_Client : public HTTP_Client
+{
+private:
+    /*
+     * A response goes out a part at a time: a string, or a move to the next
+     * response state. What a backed-up connection doesn't take is written
+     * by a later process(), which runs the response again from the top,
+     * skipping the parts that are already out.
+     */
+    bool _responding = false;
+    http_status _error = http_status::OKAY;
+    size_t _partsOut = 0;       // Parts the connection has taken
+    size_t _partOffset = 0;     // Bytes of the next part it has taken
+    size_t _part = 0;           // The part this run of the response is at
+
+    static const __FlashStringHelper* statusCode(http_status e) {
+        switch (e) {
+            case http_status::FAIL_BAD_REQUEST:
+                return F("400");
+            case http_status::FAIL_METHOD_NOT_ALLOWED:
+                return F("405");
+            case http_status::FAIL_TIMEOUT:
+                return F("408");
+            case http_status::FAIL_UNSUPPORTED:
+                return F("501");
+            default:
+                return F("500");
+        }
+    }
+
+    // Whether the part is out, asking for a later process() if it isn't
+    bool wrote(bool all) {
+        if (!all) {
+            resume();
+            return false;
+        }
+        _partsOut++;
+        _partOffset = 0;
+        return true;
+    }
+
+    bool part(const __FlashStringHelper* str) {
+        if (_part++ < _partsOut) {
+            return true;
+        }
+        const char* p = reinterpret_cast<const char*>(str);
+        _partOffset += write(F(p + _partOffset));
+        return wrote(0 == pgm_read_byte(p + _partOffset));
+    }
+
+    bool part(http_response_state state) {
+        if (_part++ < _partsOut) {
+            return true;
+        }
+        http_status status = advanceTo(state);
+        if (http_status::INCOMPLETE == status) {
+            return false;           // advanceTo() has asked to resume
+        } else if (http_status::OKAY != status) {
+            _responding = false;
+            close();
+            return false;
+        }
+        return wrote(true);
+    }
+
+    void start(http_status error) {
+        _responding = true;
+        _error = error;
+        _partsOut = 0;
+        _partOffset = 0;
+        respond();
+    }
+
+    void respond() {
+        _part = 0;
+        if (http_status::OKAY != _error) {
+            reportError();
+            return;
+        }
+
+        if (!part(http_version::HTTP_1_1 == version() ? F("HTTP/1.1")
+                                                      : F("HTTP/1.0"))
+                || !part(http_response_state::STATUS_CODE)
+                || !part(F("200"))
+                || !part(http_response_state::STATUS_REASON)
+                || !part(F("OK"))) {
+            return;
+        }
+        if (!keepAlive()
+                && (!part(http_response_state::HEADER_NAME)
+                    || !part(F("Connection"))
+                    || !part(http_response_state::HEADER_VALUE)
+                    || !part(F("close")))) {
+            return;
+        }
+        if (!part(http_response_state::BODY) || !part(F("Hello World"))) {
+            return;
+        }
+
+        _responding = false;
+        complete();
+    }
+
+    void reportError() {
+        if (!part(F("HTTP/1.0"))
+                || !part(http_response_state::STATUS_CODE)
+                || !part(statusCode(_error))
+                || !part(http_response_state::STATUS_REASON)
+                || !part(HTTPStatusToString(_error))
+                || !part(http_response_state::HEADER_NAME)
+                || !part(F("Content-Length"))
+                || !part(http_response_state::HEADER_VALUE)
+                || !part(F("0"))
+                || !part(http_response_state::BODY)) {
+            return;
+        }
+
+        _responding = false;
+        close();
+    }
+
+protected:
+    virtual void process() override
+    {
+        // The rest of a response the connection was backed up for; a new
+        // connection, which hasn't sent anything, drops any that was left
+        if (_responding && 0 < flushes()) {
+            respond();
+            return;
+        }
+        _responding = false;
+
+        // Only the parser's view of the request is used, so nothing is copied
+        const uint8_t* data;
+        size_t n_data = 64;
+
+        http_request_state state;
+        http_status status = read(&data, &n_data, &state);
+
+        switch (status) {
+            case http_status::INCOMPLETE:
+                return;
+            case http_status::OKAY:
+                break;
+            default:
+                start(status);
+                return;
+        }
+
+        if (http_request_state::BODY == state) {
+            chunked();
+            start(http_status::OKAY);
+        }
+    }
+};
+
+class Host_HTTP_Server : public HTTP_Server
+{
+    using HTTP_Server::HTTP_Server;
+private:
+    Host_HTTP_Client _clients[HTTP_MAX_CLIENTS];
+
+protected:
+    virtual HTTP_Client& client(size_t idx) override
+    {
+        return _clients[idx];
+    }
+};
+
+int main(int argc, char** argv)
+{
+    uint16_t port = argc > 1 ? atoi(argv[1]) : 8080;
+
+    Host_HTTP_Server server(port);
+
+    if (http_status::OKAY != server.begin()) {
+        fprintf(stderr, "Unable to listen on port %u\n", port);
+        return 1;
+    }
+
+    printf("Listening on port %u\n", server.port());
+    fflush(stdout);
+
+    while (http_status::OKAY == server.tick()) {
+        ;
+    }
+
+    return 1;
+}
@@ -0,0 +1,62 @@
+#include "gtest/gtest.h"
+#include "BitSet.h"
+
+TEST(BitSetTest, Empty)
+{
+    BitSet<32> b;
+    ASSERT_FALSE(b.any());
+    ASSERT_EQ(32, b.next(0));
+}
+
+TEST(BitSetTest, Fill)
+{
+    BitSet<32> b;
+    b.fill(5);
+
+    for (size_t ii = 0; ii < 32; ii++) {
+        ASSERT_EQ(ii < 5, b.test(ii));
+    }
+
+    b.fill(32);
+    ASSERT_TRUE(b.test(31));
+}
+
+TEST(BitSetTest, SetReset)
+{
+    BitSet<32> b;
+    b.set(7);
+    ASSERT_TRUE(b.test(7));
+    ASSERT_TRUE(b.any());
+
+    b.reset(7);
+    ASSERT_FALSE(b.test(7));
+    ASSERT_FALSE(b.any());
+}
+
+TEST(BitSetTest, NextAcrossWords)
+{
+    BitSet<100> b;
+    b.set(3);
+    b.set(40);
+    b.set(99);
+
+    ASSERT_EQ(3, b.next(0));
+    ASSERT_EQ(40, b.next(4));
+    ASSERT_EQ(99, b.next(41));
+    ASSERT_EQ(100, b.next(100));
+}
+
+TEST(BitSetTest, FillAcrossWords)
+{
+    BitSet<100> b;
+    b.fill(70);
+
+    ASSERT_TRUE(b.test(69));
+    ASSERT_FALSE(b.test(70));
+
+    size_t count = 0;
+    for (size_t ii = b.next(0); ii < 100; ii = b.next(ii + 1)) {
+        count++;
+    }
+    ASSERT_EQ(70, count);
+}
@@ -0,0 +1,62 @@
+#include "gtest/gtest.h"
+#include "BufferPool.h"
+
+#include <set>
+
+TEST(BufferPoolTest, AcquireAll)
+{
+    BufferPool<16, 3> pool;
+    ASSERT_EQ(3, pool.capacity());
+    ASSERT_EQ(3, pool.available());
+
+    std::set<uint8_t*> blocks;
+    for (size_t ii = 0; ii < 3; ii++) {
+        uint8_t* block = pool.acquire();
+        ASSERT_NE(nullptr, block);
+        blocks.insert(block);
+    }
+
+    ASSERT_EQ(3, blocks.size());
+    ASSERT_EQ(0, pool.available());
+    ASSERT_EQ(nullptr, pool.acquire());
+}
+
+TEST(BufferPoolTest, BlocksDontOverlap)
+{
+    BufferPool<16, 2> pool;
+    uint8_t* a = pool.acquire();
+    uint8_t* b = pool.acquire();
+
+    ASSERT_LE(16, a < b ? b - a : a - b);
+}
+
+TEST(BufferPoolTest, ReleaseReuses)
+{
+    BufferPool<16, 2> pool;
+    uint8_t* a = pool.acquire();
+    uint8_t* b = pool.acquire();
+
+    pool.release(a);
+    ASSERT_EQ(1, pool.available());
+    ASSERT_EQ(a, pool.acquire());
+
+    pool.release(b);
+    pool.release(a);
+    ASSERT_EQ(2, pool.available());
+}
+
+TEST(BufferPoolTest, ReleaseIgnoresStrangers)
+{
+    BufferPool<16, 2> pool;
+    uint8_t other[16];
+    uint8_t* a = pool.acquire();
+
+    pool.release(NULL);
+    pool.release(other);
+    ASSERT_EQ(1, pool.available());
+
+    // Twice is the same as once
+    pool.release(a);
+    pool.release(a);
+    ASSERT_EQ(2, pool.available());
+}
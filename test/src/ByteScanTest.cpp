@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+#include "ByteScan.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+TEST(ByteScanTest, Empty)
+{
+    const uint8_t data[] = {'a'};
+    ASSERT_EQ(NULL, byteScan(data, 0, 'a'));
+}
+
+TEST(ByteScanTest, EveryPosition)
+{
+    // Long enough to go through the 32 and 16 byte loops and the tail
+    std::vector<uint8_t> data(100, 'x');
+
+    for (size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = '\n';
+        ASSERT_EQ(&data[ii], byteScan(data.data(), data.size(), '\n')) << ii;
+        data[ii] = 'x';
+    }
+
+    ASSERT_EQ(NULL, byteScan(data.data(), data.size(), '\n'));
+}
+
+TEST(ByteScanTest, FirstOfSeveral)
+{
+    const uint8_t terms[] = {' ', ':', '\n'};
+    std::string line = "Content-Length-Is-A-Long-Header-Name: 5\r\n";
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(line.data());
+
+    ASSERT_EQ(p + line.find(':'), byteScan(p, line.size(), terms));
+    ASSERT_EQ(p + line.find(':'), byteScanScalar(p, line.size(), terms));
+
+    // Only the first n bytes are looked at
+    ASSERT_EQ(NULL, byteScan(p, line.find(':'), terms));
+}
+
+TEST(ByteScanTest, HighBytes)
+{
+    std::vector<uint8_t> data(40, 0x7f);
+    data[37] = 0xff;
+    ASSERT_EQ(&data[37], byteScan(data.data(), data.size(), 0xff));
+}
+
+// Runs scan over every line of the corpus, returning the lines found
+template<typename F>
+static size_t countLines(const std::vector<uint8_t>& corpus, F scan)
+{
+    size_t lines = 0;
+    const uint8_t* p = corpus.data();
+    const uint8_t* end = p + corpus.size();
+
+    while (p < end) {
+        const uint8_t* hit = scan(p, end - p);
+        if (NULL == hit) {
+            break;
+        }
+        p = hit + 1;
+        lines++;
+    }
+
+    return lines;
+}
+
+TEST(ByteScanTest, BenchmarkGigabytesPerSecond)
+{
+    static const char request[] =
+        "GET /static/js/app.min.js?v=20141017 HTTP/1.1\r\n"
+        "Host: shock.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "Accept: application/javascript, */*;q=0.8\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+            "(KHTML, like Gecko) Chrome/38.0.2125.104 Safari/537.36\r\n"
+        "Referer: http://shock.example.com/dashboard/sensors\r\n"
+        "Accept-Encoding: gzip, deflate, sdch\r\n"
+        "Accept-Language: en-US,en;q=0.8\r\n"
+        "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+        "\r\n";
+
+    std::vector<uint8_t> corpus;
+    while (corpus.size() < (1 << 20)) {
+        corpus.insert(corpus.end(), request, request + sizeof(request) - 1);
+    }
+
+    const int rounds = 20;
+
+    auto run = [&](const char* name, const uint8_t* (*scan)(const uint8_t*,
+                                                                size_t)) {
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int ii = 0; ii < rounds; ii++) {
+            found += countLines(corpus, scan);
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << "[ BENCH    ] " << name << ": "
+                  << corpus.size() * rounds / elapsed.count() / 1e9
+                  << " GB/s" << std::endl;
+        return found;
+    };
+
+    size_t scalarLines = run("scalar '\\n'", [](const uint8_t* p, size_t n) {
+        const uint8_t t[] = {'\n'};
+        return byteScanScalar<1>(p, n, t);
+    });
+    size_t vectorLines = run("byteScan '\\n'", [](const uint8_t* p, size_t n) {
+        return byteScan(p, n, '\n');
+    });
+    ASSERT_EQ(scalarLines, vectorLines);
+
+    scalarLines = run("scalar ' ' ':' '\\n'", [](const uint8_t* p, size_t n) {
+        const uint8_t t[] = {' ', ':', '\n'};
+        return byteScanScalar(p, n, t);
+    });
+    vectorLines = run("byteScan ' ' ':' '\\n'", [](const uint8_t* p, size_t n) {
+        const uint8_t t[] = {' ', ':', '\n'};
+        return byteScan(p, n, t);
+    });
+    ASSERT_EQ(scalarLines, vectorLines);
+}
@@ -0,0 +1,1934 @@
+#include "gtest/gtest.h"
+#include "HTTP_Server.h"
+#include "HTTP_File.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr const char* const CONTENT_TYPES[] = {"text/plain", "application/json"};
+static const StringComparator contentTypes = STRING_COMPARATOR_NOCASE(CONTENT_TYPES);
+
+// Content-Length is already built in, so it should never be reported
+constexpr const char* const TEST_HEADER_NAMES[] = {"Host", "Content-Type",
+                                                    "X-Retries", "Content-Length"};
+static const HTTP_HeaderSpec TEST_HEADER_SPECS[] = {
+    {http_header_kind::SPAN, NULL},
+    {http_header_kind::TOKEN, &contentTypes},
+    {http_header_kind::INTEGER, NULL},
+    {http_header_kind::INTEGER, NULL},
+};
+static const HTTP_HeaderTable TEST_HEADERS
+    = HTTP_HEADER_TABLE(TEST_HEADER_NAMES, TEST_HEADER_SPECS);
+
+constexpr const char* const TEST_ROUTES[] = {"/", "/index.html", "/files/*",
+                                                "/files/private/*", "*"};
+static const StringComparator testRoutes = STRING_COMPARATOR(TEST_ROUTES);
+static const http_methods TEST_ROUTE_METHODS[] = {
+    HTTPMethodBit(http_method::GET) | HTTPMethodBit(http_method::HEAD),
+    HTTP_ANY_METHOD,
+    HTTPMethodBit(http_method::GET),
+    HTTP_ANY_METHOD,
+    HTTP_ANY_METHOD,
+};
+
+class Test_HTTP_Client : public HTTP_Client
+{
+public:
+    std::string path;
+    std::vector<std::string> headers;   // "Name=value" for each reported
+    std::string host;                   // The pieces of the Host span
+    std::string routed;                 // The route the path matched
+    http_method method = http_method::UNKNOWN;
+    http_status failure = http_status::OKAY;
+    std::string body;
+    bool chunkedResponse = false;
+    std::string largeBody;      // Body sent in as few write()s; chunked, or
+                                // with persistent, the next response's only
+    std::vector<size_t> largeSteps;     // Sizes of its writes, in turn
+    size_t largeSent = 0;
+    size_t largeWrites = 0;
+    bool writingLarge = false;
+    bool persistent = false;    // Echo the path, keeping the connection
+    bool inPlace = false;       // Read without copying
+    bool stalled = false;       // Leave input unread
+    bool greedy = false;        // Read on after complete() in one process()
+    std::string padding;        // An X-Padding header in persistent responses
+
+    Test_HTTP_Client()
+        : HTTP_Client(TEST_HEADERS, testRoutes, TEST_ROUTE_METHODS) {}
+
+protected:
+    virtual void header(const http_header_event& e) override
+    {
+        std::string value;
+        if (http_header_kind::SPAN == e.kind) {
+            host.append(reinterpret_cast<const char*>(e.data), e.length);
+            if (!e.last) {
+                return;
+            }
+            value = host;
+            host.clear();
+        } else if (!e.valid) {
+            value = "?";
+        } else if (http_header_kind::INTEGER == e.kind) {
+            value = std::to_string(e.integer);
+        } else {
+            value = CONTENT_TYPES[e.token];
+        }
+        headers.push_back(std::string(TEST_HEADER_NAMES[e.header]) + "=" + value);
+    }
+
+    // As much of the rest of largeBody as the connection takes
+    void writeLarge()
+    {
+        while (largeSent < largeBody.size()) {
+            size_t n = largeBody.size() - largeSent;
+            if (!largeSteps.empty()) {
+                n = std::min(n, largeSteps[largeWrites++ % largeSteps.size()]);
+            }
+
+            size_t taken = write(
+                reinterpret_cast<uint8_t*>(&largeBody[largeSent]), n);
+            largeSent += taken;
+            if (taken < n) {
+                break;
+            }
+        }
+
+        writingLarge = largeSent < largeBody.size();
+        if (writingLarge) {
+            resume();
+        } else if (persistent) {
+            largeBody.clear();
+            complete();
+        } else {
+            close();
+        }
+    }
+
+    virtual void process() override
+    {
+        if (stalled) {
+            return;
+        } else if (writingLarge) {
+            writeLarge();
+            if (writingLarge || !greedy) {
+                return;
+            }
+        }
+
+        while (step() && greedy) {
+        }
+    }
+
+    // One read(), and whatever it calls for; whether to read on
+    bool step()
+    {
+        uint8_t buf[65];
+        const uint8_t* data = buf;
+        size_t n_buf = 64;
+
+        http_request_state state;
+        http_status status = inPlace ? read(&data, &n_buf, &state)
+                                     : read(buf, &n_buf, &state);
+
+        if (http_request_state::PATH == state) {
+            path.append(reinterpret_cast<const char*>(data), n_buf);
+        } else if (http_request_state::BODY == state
+                || http_request_state::DONE == state) {
+            body.append(reinterpret_cast<const char*>(data), n_buf);
+        }
+
+        if (http_status::INCOMPLETE == status) {
+            return false;
+        } else if (http_status::OKAY != status) {
+            failure = status;
+            close();
+            return false;
+        }
+
+        switch (state) {
+            case http_request_state::PATH:
+                size_t idx;
+                routed = route(idx) ? TEST_ROUTES[idx] : "none";
+                method = HTTP_Client::method();
+                break;
+            case http_request_state::VERSION:
+                write(F("HTTP/1.1"));
+                advanceTo(http_response_state::STATUS_CODE);
+                break;
+            case http_request_state::BODY:
+                write(F("200"));
+                advanceTo(http_response_state::STATUS_REASON);
+                write(F("OK"));
+                if (persistent) {
+                    std::string length = std::to_string(
+                        largeBody.empty() ? path.size() : largeBody.size());
+                    advanceTo(http_response_state::HEADER_NAME);
+                    write(F("Content-Length"));
+                    advanceTo(http_response_state::HEADER_VALUE);
+                    write(length.c_str());
+                    if (!padding.empty()) {
+                        advanceTo(http_response_state::HEADER_NAME);
+                        write(F("X-Padding"));
+                        advanceTo(http_response_state::HEADER_VALUE);
+                        write(padding.c_str());
+                    }
+                    advanceTo(http_response_state::BODY);
+                    if (!largeBody.empty()) {
+                        path.clear();
+                        largeSent = 0;
+                        writeLarge();
+                        return !writingLarge;
+                    }
+                    write(path.c_str());
+                    path.clear();
+                    complete();
+                    return true;
+                }
+                if (chunkedResponse) {
+                    advanceTo(http_response_state::HEADER_NAME);
+                    write(F("Connection"));
+                    advanceTo(http_response_state::HEADER_VALUE);
+                    write(F("close"));
+                    chunked();
+                    advanceTo(http_response_state::BODY);
+                    if (!largeBody.empty()) {
+                        largeSent = 0;
+                        writeLarge();
+                        return false;
+                    }
+                    write(F("Hello"));
+                    write(F(""));
+                    write(" World");
+                    close();
+                    return false;
+                }
+                advanceTo(http_response_state::HEADER_NAME);
+                write(F("Content-Length"));
+                advanceTo(http_response_state::HEADER_VALUE);
+                write(F("11"));
+                advanceTo(http_response_state::HEADER_NAME);
+                write(F("Connection"));
+                advanceTo(http_response_state::HEADER_VALUE);
+                write(F("close"));
+                advanceTo(http_response_state::BODY);
+                write(F("Hello World"));
+                close();
+                return false;
+            default:
+                break;
+        }
+        return true;
+    }
+};
+
+// Streams its body over several calls to process(), using resume()
+class Streaming_HTTP_Client : public HTTP_Client
+{
+private:
+    int _remaining = 0;
+
+protected:
+    virtual void process() override
+    {
+        if (_remaining > 0) {
+            write(F("chunk"));
+            if (0 == --_remaining) {
+                close();
+            } else {
+                resume();
+            }
+            return;
+        }
+
+        uint8_t buf[64];
+        size_t n_buf = sizeof(buf);
+
+        http_request_state state;
+        http_status status = read(buf, &n_buf, &state);
+
+        if (http_status::OKAY == status
+                && http_request_state::BODY == state) {
+            write(F("HTTP/1.0"));
+            advanceTo(http_response_state::STATUS_CODE);
+            write(F("200"));
+            advanceTo(http_response_state::STATUS_REASON);
+            write(F("OK"));
+            advanceTo(http_response_state::BODY);
+            _remaining = 5;
+            resume();
+        }
+    }
+};
+
+/*
+ * Time stands still unless a test moves it on, and tick() never waits for
+ * the network, so timeouts are stepped through rather than slept through.
+ */
+class Clocked_HTTP_Server : public HTTP_Server
+{
+public:
+    unsigned long time = 0;
+
+    Clocked_HTTP_Server() : HTTP_Server(0) {}
+
+    // Ticks, moving the clock on by ms first
+    void tick(unsigned long ms)
+    {
+        time += ms;
+        HTTP_Server::tick();
+    }
+    using HTTP_Server::tick;
+
+protected:
+    virtual unsigned long clockMillis() override { return time; }
+    virtual int pollTimeout() override { return 0; }
+};
+
+class Streaming_HTTP_Server : public Clocked_HTTP_Server
+{
+public:
+    Streaming_HTTP_Client clients[HTTP_MAX_CLIENTS];
+
+protected:
+    virtual HTTP_Client& client(size_t idx) override
+    {
+        return clients[idx];
+    }
+};
+
+class Test_HTTP_Server : public Clocked_HTTP_Server
+{
+public:
+    Test_HTTP_Client clients[HTTP_MAX_CLIENTS];
+
+protected:
+    virtual HTTP_Client& client(size_t idx) override
+    {
+        return clients[idx];
+    }
+};
+
+// Talks to a server of type S over loopback
+template<typename S>
+class HTTP_ServerFixture : public ::testing::Test
+{
+protected:
+    S server;
+
+    virtual void SetUp() override
+    {
+        ASSERT_EQ(http_status::OKAY, server.begin());
+    }
+
+    // With rcvbuf, the peer's receive window is kept that small
+    int connectClient(int rcvbuf = 0)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        // Small pieces must go out right away, not wait for an ACK
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (0 < rcvbuf) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(server.port());
+
+        if (0 > connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                        sizeof(addr))) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // The server's end of a connection it has accepted, or -1
+    int serverSide(int fd)
+    {
+        struct sockaddr_in local, peer;
+        socklen_t len = sizeof(local);
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&local), &len);
+        for (int ii = 0; ii < 1024; ii++) {
+            len = sizeof(peer);
+            if (ii != fd && 0 == getpeername(
+                    ii, reinterpret_cast<struct sockaddr*>(&peer), &len)
+                    && peer.sin_port == local.sin_port
+                    && peer.sin_addr.s_addr == local.sin_addr.s_addr) {
+                return ii;
+            }
+        }
+        return -1;
+    }
+
+    // Ticks the server until the peer closes the connection
+    std::string receive(int fd)
+    {
+        std::string response;
+        char buf[65536];
+
+        for (unsigned long start = millis(); millis() - start < 5000;) {
+            server.tick();
+
+            ssize_t r;
+            while (0 < (r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT))) {
+                response.append(buf, r);
+            }
+            if (0 == r) {
+                break;
+            }
+        }
+
+        return response;
+    }
+
+    /*
+     * Closes the connection, and ticks until the server has seen it go, so
+     * the next connection gets the same slot.
+     */
+    void hangUp(int fd)
+    {
+        close(fd);
+        for (unsigned long start = millis(); millis() - start < 1000;) {
+            server.tick();
+
+            bool connected = false;
+            for (size_t ii = 0; ii < HTTP_MAX_CLIENTS && !connected; ii++) {
+                connected = server.clients[ii].connected();
+            }
+            if (!connected) {
+                break;
+            }
+        }
+    }
+
+    // Sends the request a few bytes at a time, ticking in between
+    std::string exchangeSlowly(const std::string& request, size_t step)
+    {
+        int fd = connectClient();
+        if (0 > fd) {
+            return std::string();
+        }
+
+        for (size_t ii = 0; ii < request.size(); ii += step) {
+            std::string piece = request.substr(ii, step);
+            send(fd, piece.data(), piece.size(), 0);
+            for (int jj = 0; jj < 3; jj++) {
+                server.tick();
+            }
+        }
+
+        std::string response = receive(fd);
+        hangUp(fd);
+        return response;
+    }
+
+    std::string exchange(const std::string& request)
+    {
+        int fd = connectClient();
+        if (0 > fd) {
+            return std::string();
+        }
+
+        send(fd, request.data(), request.size(), 0);
+        std::string response = receive(fd);
+        hangUp(fd);
+        return response;
+    }
+};
+
+class HTTP_ServerTest : public HTTP_ServerFixture<Test_HTTP_Server> {};
+
+static const char RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 11\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Hello World";
+
+TEST_F(HTTP_ServerTest, SimpleGet)
+{
+    std::string response = exchange("GET /index.html HTTP/1.1\r\n"
+                                    "Host: localhost\r\n"
+                                    "\r\n");
+    ASSERT_EQ(RESPONSE, response);
+    ASSERT_EQ("/index.html", server.clients[0].path);
+}
+
+TEST_F(HTTP_ServerTest, CoalescesWrites)
+{
+    ASSERT_EQ(RESPONSE, exchange("GET / HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(2u, server.clients[0].flushes());
+}
+
+TEST_F(HTTP_ServerTest, PostWithContentLength)
+{
+    std::string response = exchange("POST /upload HTTP/1.1\r\n"
+                                    "Content-Length: 5\r\n"
+                                    "\r\n"
+                                    "abcde");
+    ASSERT_EQ(RESPONSE, response);
+    ASSERT_EQ("abcde", server.clients[0].body);
+}
+
+static const char CHUNKED_REQUEST[] =
+    "POST /upload HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "4\r\n"
+    "Wiki\r\n"
+    "5;name=value\r\n"
+    "pedia\r\n"
+    "E\r\n"
+    " in\r\n\r\nchunks.\r\n"
+    "0\r\n"
+    "Expires: never\r\n"
+    "\r\n";
+
+TEST_F(HTTP_ServerTest, LowerCaseHeaders)
+{
+    std::string response = exchange("POST /upload HTTP/1.1\r\n"
+                                    "content-length: 5\r\n"
+                                    "\r\n"
+                                    "abcde");
+    ASSERT_EQ(RESPONSE, response);
+    ASSERT_EQ("abcde", server.clients[0].body);
+
+    server.clients[0].body.clear();
+    response = exchange("POST /upload HTTP/1.1\r\n"
+                        "TRANSFER-ENCODING: Chunked\r\n"
+                        "\r\n"
+                        "3\r\nabc\r\n0\r\n\r\n");
+    ASSERT_EQ(RESPONSE, response);
+    ASSERT_EQ("abc", server.clients[0].body);
+}
+
+TEST_F(HTTP_ServerTest, PostChunked)
+{
+    ASSERT_EQ(RESPONSE, exchange(CHUNKED_REQUEST));
+    ASSERT_EQ("Wikipedia in\r\n\r\nchunks.", server.clients[0].body);
+}
+
+TEST_F(HTTP_ServerTest, PostChunkedSplit)
+{
+    for (size_t step = 1; step < 8; step++) {
+        SCOPED_TRACE(step);
+        server.clients[0].body.clear();
+        ASSERT_EQ(RESPONSE, exchangeSlowly(CHUNKED_REQUEST, step));
+        ASSERT_EQ("Wikipedia in\r\n\r\nchunks.", server.clients[0].body);
+    }
+}
+
+TEST_F(HTTP_ServerTest, GetSplit)
+{
+    for (size_t step = 1; step < 8; step++) {
+        SCOPED_TRACE(step);
+        ASSERT_EQ(RESPONSE, exchangeSlowly("GET / HTTP/1.1\r\nHost: x\r\n\r\n", step));
+    }
+}
+
+TEST_F(HTTP_ServerTest, PostChunkedBadSize)
+{
+    exchange("POST /upload HTTP/1.1\r\n"
+             "Transfer-Encoding: chunked\r\n"
+             "\r\n"
+             "x\r\n");
+
+    ASSERT_EQ("", server.clients[0].body);
+}
+
+TEST_F(HTTP_ServerTest, ReadInPlace)
+{
+    server.clients[0].inPlace = true;
+
+    ASSERT_EQ(RESPONSE, exchange("POST /upload HTTP/1.1\r\n"
+                                "Content-Length: 5\r\n"
+                                "\r\n"
+                                "abcde"));
+    ASSERT_EQ("/upload", server.clients[0].path);
+    ASSERT_EQ("abcde", server.clients[0].body);
+
+    server.clients[0].path.clear();
+    server.clients[0].body.clear();
+    ASSERT_EQ(RESPONSE, exchange(CHUNKED_REQUEST));
+    ASSERT_EQ("Wikipedia in\r\n\r\nchunks.", server.clients[0].body);
+}
+
+TEST_F(HTTP_ServerTest, ReadInPlaceSplit)
+{
+    server.clients[0].inPlace = true;
+
+    for (size_t step = 1; step < 8; step++) {
+        SCOPED_TRACE(step);
+        server.clients[0].body.clear();
+        ASSERT_EQ(RESPONSE, exchangeSlowly(CHUNKED_REQUEST, step));
+        ASSERT_EQ("Wikipedia in\r\n\r\nchunks.", server.clients[0].body);
+    }
+}
+
+static const char SUBSCRIBED_REQUEST[] =
+    "POST /upload HTTP/1.1\r\n"
+    "host: example.com:8080\r\n"
+    "Content-Type: Application/JSON\r\n"
+    "Accept: */*\r\n"
+    "X-Retries: 12\r\n"
+    "Content-Length: 2\r\n"
+    "Content-Type: text/html\r\n"
+    "X-Retries: many\r\n"
+    "Host:\r\n"
+    "\r\n"
+    "{}";
+
+static const std::vector<std::string> SUBSCRIBED_HEADERS = {
+    "Host=example.com:8080", "Content-Type=application/json", "X-Retries=12",
+    "Content-Type=?", "X-Retries=?", "Host=",
+};
+
+TEST_F(HTTP_ServerTest, SubscribedHeaders)
+{
+    ASSERT_EQ(RESPONSE, exchange(SUBSCRIBED_REQUEST));
+    ASSERT_EQ(SUBSCRIBED_HEADERS, server.clients[0].headers);
+    ASSERT_EQ("{}", server.clients[0].body);
+}
+
+TEST_F(HTTP_ServerTest, SubscribedHeadersSplit)
+{
+    for (int inPlace = 0; inPlace < 2; inPlace++) {
+        server.clients[0].inPlace = inPlace;
+
+        for (size_t step = 1; step < 8; step++) {
+            SCOPED_TRACE(step);
+            server.clients[0].headers.clear();
+            server.clients[0].body.clear();
+            ASSERT_EQ(RESPONSE, exchangeSlowly(SUBSCRIBED_REQUEST, step));
+            ASSERT_EQ(SUBSCRIBED_HEADERS, server.clients[0].headers);
+            ASSERT_EQ("{}", server.clients[0].body);
+        }
+    }
+}
+
+static const char* const ROUTED_PATHS[][2] = {
+    {"/", "/"},
+    {"/index.html", "/index.html"},
+    {"/index.html?q=a/b", "/index.html"},
+    {"/index.htm", "*"},
+    {"/index.html2", "*"},
+    {"/files/", "/files/*"},
+    {"/files/a/b.txt", "/files/*"},
+    {"/files/a?x=/files/private/", "/files/*"},
+    {"/files/private/key", "/files/private/*"},
+    {"/files/private", "/files/*"},
+    {"/files", "*"},
+    {"?", "*"},
+};
+
+TEST_F(HTTP_ServerTest, Routes)
+{
+    for (const auto& p : ROUTED_PATHS) {
+        SCOPED_TRACE(p[0]);
+        server.clients[0].routed.clear();
+        exchange(std::string("GET ") + p[0] + " HTTP/1.1\r\n\r\n");
+        ASSERT_EQ(p[1], server.clients[0].routed);
+    }
+}
+
+TEST_F(HTTP_ServerTest, RoutesSplit)
+{
+    server.clients[0].inPlace = true;
+
+    // A byte at a time, so every prefix of every path is seen on its own
+    for (const auto& p : ROUTED_PATHS) {
+        SCOPED_TRACE(p[0]);
+        server.clients[0].routed.clear();
+        exchangeSlowly(std::string("GET ") + p[0] + " HTTP/1.1\r\n\r\n", 1);
+        ASSERT_EQ(p[1], server.clients[0].routed);
+    }
+}
+
+TEST_F(HTTP_ServerTest, Methods)
+{
+    const std::pair<const char*, http_method> methods[] = {
+        {"GET", http_method::GET}, {"HEAD", http_method::HEAD},
+        {"POST", http_method::POST}, {"PUT", http_method::PUT},
+        {"DELETE", http_method::DELETE}, {"OPTIONS", http_method::OPTIONS},
+        {"PATCH", http_method::PATCH}, {"TRACE", http_method::TRACE},
+        {"CONNECT", http_method::CONNECT},
+    };
+
+    for (const auto& m : methods) {
+        SCOPED_TRACE(m.first);
+        server.clients[0].method = http_method::UNKNOWN;
+        ASSERT_EQ(RESPONSE, exchangeSlowly(std::string(m.first)
+                                            + " /upload HTTP/1.1\r\n\r\n", 3));
+        ASSERT_EQ(m.second, server.clients[0].method);
+    }
+}
+
+TEST_F(HTTP_ServerTest, MethodNotAllowed)
+{
+    ASSERT_EQ("", exchange("POST / HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(http_status::FAIL_METHOD_NOT_ALLOWED, server.clients[0].failure);
+
+    server.clients[0].failure = http_status::OKAY;
+    ASSERT_EQ("", exchange("HEAD /files/a HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(http_status::FAIL_METHOD_NOT_ALLOWED, server.clients[0].failure);
+
+    server.clients[0].failure = http_status::OKAY;
+    ASSERT_EQ(RESPONSE, exchange("HEAD / HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(RESPONSE, exchange("DELETE /index.html HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(http_status::OKAY, server.clients[0].failure);
+}
+
+TEST_F(HTTP_ServerTest, UnknownMethod)
+{
+    const char* const requests[] = {"BREW / HTTP/1.1\r\n\r\n",
+                                    "get / HTTP/1.1\r\n\r\n",
+                                    "GETS / HTTP/1.1\r\n\r\n",
+                                    " / HTTP/1.1\r\n\r\n"};
+
+    for (const char* request : requests) {
+        SCOPED_TRACE(request);
+        server.clients[0].failure = http_status::OKAY;
+        ASSERT_EQ("", exchange(request));
+        ASSERT_EQ(http_status::FAIL_UNSUPPORTED, server.clients[0].failure);
+    }
+}
+
+TEST_F(HTTP_ServerTest, OverlongMethod)
+{
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    // Never sends a space, but is turned away after the eighth byte
+    const char garbage[] = "\x16\x03\x01\x02\x00\x01\x00\x01";
+    send(fd, garbage, sizeof(garbage) - 1, 0);
+    ASSERT_EQ("", receive(fd));
+    close(fd);
+
+    ASSERT_EQ(http_status::FAIL_BAD_REQUEST, server.clients[0].failure);
+}
+
+TEST_F(HTTP_ServerTest, ChunkedResponse)
+{
+    server.clients[0].chunkedResponse = true;
+
+    ASSERT_EQ("HTTP/1.1 200 OK\r\n"
+              "Connection: close\r\n"
+              "Transfer-Encoding: chunked\r\n"
+              "\r\n"
+              "b\r\nHello World\r\n"
+              "0\r\n\r\n",
+              exchange("GET / HTTP/1.1\r\n\r\n"));
+
+    // The headers when the body starts, then the body with the last chunk
+    ASSERT_EQ(2u, server.clients[0].flushes());
+}
+
+TEST_F(HTTP_ServerTest, LargeChunks)
+{
+    static const char HEAD[] = "HTTP/1.1 200 OK\r\n"
+                               "Connection: close\r\n"
+                               "Transfer-Encoding: chunked\r\n"
+                               "\r\n";
+    server.clients[0].chunkedResponse = true;
+
+    // Sent without going through the transmit buffer, in pieces the
+    // transport can take
+    const size_t sizes[] = {256, 4096, 65535, 65536, 70000};
+    for (size_t size : sizes) {
+        SCOPED_TRACE(size);
+
+        std::string body;
+        for (size_t ii = 0; ii < size; ii++) {
+            body += static_cast<char>('a' + ii % 26);
+        }
+        server.clients[0].largeBody = body;
+
+        std::string expected = HEAD;
+        for (size_t ii = 0; ii < size; ii += UINT16_MAX) {
+            size_t piece = std::min<size_t>(UINT16_MAX, size - ii);
+            char header[16];
+            snprintf(header, sizeof(header), "%zx\r\n", piece);
+            expected += header + body.substr(ii, piece) + "\r\n";
+        }
+        expected += "0\r\n\r\n";
+
+        ASSERT_EQ(expected, exchange("GET / HTTP/1.1\r\n\r\n"));
+    }
+}
+
+// The body of a chunked response, or "?" if its framing is broken
+static std::string unchunk(const std::string& chunked)
+{
+    std::string body;
+    for (size_t pos = 0;;) {
+        size_t eol = chunked.find("\r\n", pos);
+        if (std::string::npos == eol) {
+            return "?";
+        }
+
+        size_t size = strtoul(chunked.substr(pos, eol - pos).c_str(), NULL, 16);
+        pos = eol + 2;
+        if (0 == size) {
+            return "\r\n" == chunked.substr(pos) ? body : "?";
+        } else if (0 != chunked.compare(pos + size, 2, "\r\n")) {
+            return "?";
+        }
+
+        body += chunked.substr(pos, size);
+        pos += size + 2;
+    }
+}
+
+TEST_F(HTTP_ServerTest, WriteDoesNotWait)
+{
+    server.clients[0].chunkedResponse = true;
+    std::string body;
+    for (size_t ii = 0; body.size() < 8 << 20; ii++) {
+        body += std::to_string(ii) + "\n";
+    }
+    server.clients[0].largeBody = body;
+
+    // Far more than the socket buffers hold while the peer isn't reading
+    int fd = connectClient(4096);
+    ASSERT_LE(0, fd);
+    std::string request = "GET / HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    for (int ii = 0; ii < 10; ii++) {
+        unsigned long start = millis();
+        server.tick();
+        ASSERT_GT(100u, millis() - start);
+    }
+    ASSERT_TRUE(server.clients[0].writingLarge);
+
+    // The rest follows as the peer takes it, the writes carrying on
+    // across chunks the transport only took part of
+    std::string response = receive(fd);
+    hangUp(fd);
+    size_t start = response.find("\r\n\r\n") + 4;
+    ASSERT_EQ(body.size(), unchunk(response.substr(start)).size());
+    ASSERT_TRUE(body == unchunk(response.substr(start)));
+}
+
+TEST_F(HTTP_ServerTest, BackedUpWritesOfAnySize)
+{
+    server.clients[0].chunkedResponse = true;
+    server.clients[0].largeSteps = {1, 13, 500, 1000, 1017, 2000, 70000};
+    std::string body;
+    for (size_t ii = 0; body.size() < 8 << 20; ii++) {
+        body += std::to_string(ii) + "\n";
+    }
+    server.clients[0].largeBody = body;
+
+    int fd = connectClient(4096);
+    ASSERT_LE(0, fd);
+    std::string request = "GET / HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+    for (int ii = 0; ii < 10; ii++) {
+        server.tick();
+    }
+
+    std::string response = receive(fd);
+    hangUp(fd);
+    std::string received = unchunk(response.substr(response.find("\r\n\r\n") + 4));
+    ASSERT_EQ(body.size(), received.size());
+    ASSERT_TRUE(body == received);
+}
+
+TEST_F(HTTP_ServerTest, SendTimeout)
+{
+    HTTP_Timeouts timeouts = server.timeouts();
+    timeouts.send = 200;
+    server.timeouts(timeouts);
+    server.clients[0].chunkedResponse = true;
+    server.clients[0].largeBody = std::string(8 << 20, 'x');
+
+    int fd = connectClient(4096);
+    ASSERT_LE(0, fd);
+    std::string request = "GET / HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    // Never reads, so the server gives up on it
+    for (unsigned long start = millis(); millis() - start < 3000
+            && 0 == server.evictions();) {
+        server.tick(10);
+    }
+    ASSERT_EQ(1u, server.evictions());
+
+    for (unsigned long start = millis(); millis() - start < 1000
+            && server.clients[0].connected();) {
+        server.tick();
+    }
+    ASSERT_FALSE(server.clients[0].connected());
+    close(fd);
+}
+
+TEST_F(HTTP_ServerTest, ChunkedResponseToHTTP10)
+{
+    server.clients[0].chunkedResponse = true;
+
+    // Sent as-is, delimited by the connection closing
+    ASSERT_EQ("HTTP/1.1 200 OK\r\n"
+              "Connection: close\r\n"
+              "\r\n"
+              "Hello World",
+              exchange("GET / HTTP/1.0\r\n\r\n"));
+}
+
+TEST_F(HTTP_ServerTest, KeepAlive)
+{
+    server.clients[0].persistent = true;
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    std::string response;
+    std::string request = "GET /first HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    char buf[256];
+    for (unsigned long start = millis(); millis() - start < 5000
+            && response.size() < 44;) {
+        server.tick();
+
+        ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        ASSERT_NE(0, r) << "closed too early";
+        if (0 < r) {
+            response.append(buf, r);
+        }
+    }
+
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\n/first", response);
+
+    // The same connection takes another request, and honours close
+    request = "GET /second HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\n/second",
+              receive(fd));
+    close(fd);
+}
+
+TEST_F(HTTP_ServerTest, Pipelined)
+{
+    server.clients[0].persistent = true;
+
+    // Several requests in one go, with a stray blank line between two
+    std::string response = exchange("GET /a HTTP/1.1\r\n\r\n"
+                                    "POST /b HTTP/1.1\r\n"
+                                    "Content-Length: 3\r\n"
+                                    "\r\n"
+                                    "xyz\r\n"
+                                    "GET /c HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "\r\n");
+
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/b"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/c",
+              response);
+}
+
+TEST_F(HTTP_ServerTest, PipelinedToSlowReader)
+{
+    server.clients[0].persistent = true;
+    std::string body;
+    for (size_t ii = 0; body.size() < 8 << 20; ii++) {
+        body += std::to_string(ii) + "\n";
+    }
+    server.clients[0].largeBody = body;
+
+    // A response far bigger than the socket buffers, with many small ones
+    // behind it
+    int fd = connectClient(2048);
+    ASSERT_LE(0, fd);
+    std::string requests = "GET /big HTTP/1.1\r\n\r\n";
+    for (int ii = 0; ii < 199; ii++) {
+        requests += "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+    }
+    requests += "GET /last HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(fd, requests.data(), requests.size(), 0);
+
+    // The peer reads a little at a time until the big one has been
+    // written, which leaves the connection full, then stops for a while
+    std::string response;
+    char buf[4096];
+    for (int ii = 0; ii < 10; ii++) {
+        server.tick();
+    }
+    ASSERT_TRUE(server.clients[0].writingLarge);
+    for (unsigned long start = millis(); millis() - start < 5000
+            && server.clients[0].writingLarge;) {
+        ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (0 < r) {
+            response.append(buf, r);
+        }
+        server.tick();
+    }
+    ASSERT_FALSE(server.clients[0].writingLarge);
+    for (int ii = 0; ii < 100; ii++) {
+        server.tick();
+    }
+
+    response += receive(fd);
+    hangUp(fd);
+
+    // Each response came whole, after the one before it
+    std::string expected = "HTTP/1.1 200 OK\r\nContent-Length: "
+        + std::to_string(body.size()) + "\r\n\r\n" + body;
+    for (int ii = 0; ii < 199; ii++) {
+        std::string path = "/" + std::to_string(ii);
+        expected += "HTTP/1.1 200 OK\r\nContent-Length: "
+            + std::to_string(path.size()) + "\r\n\r\n" + path;
+    }
+    expected += "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n/last";
+    ASSERT_EQ(expected.size(), response.size());
+    ASSERT_TRUE(expected == response);
+}
+
+TEST_F(HTTP_ServerTest, PipelinedWhileBackedUp)
+{
+    // The application reads the next request straight after complete(), and
+    // writes its headers without looking at the results
+    server.clients[0].persistent = true;
+    server.clients[0].greedy = true;
+    server.clients[0].padding = std::string(900, 'p');
+
+    // Small socket buffers, so that one turn's worth of responses fills them
+    int fd = connectClient(2048);
+    ASSERT_LE(0, fd);
+    server.tick();
+    int accepted = serverSide(fd);
+    ASSERT_LE(0, accepted);
+    int sndbuf = 2048;
+    setsockopt(accepted, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    std::string requests;
+    for (int ii = 0; ii < 199; ii++) {
+        requests += "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+    }
+    requests += "GET /last HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(fd, requests.data(), requests.size(), 0);
+    for (int ii = 0; ii < 100; ii++) {
+        server.tick();
+    }
+
+    std::string response = receive(fd);
+    hangUp(fd);
+
+    // Each response came whole, after the one before it
+    std::string expected;
+    for (int ii = 0; ii < 200; ii++) {
+        std::string path = 199 == ii ? "/last" : "/" + std::to_string(ii);
+        expected += "HTTP/1.1 200 OK\r\nContent-Length: "
+            + std::to_string(path.size()) + "\r\nX-Padding: "
+            + server.clients[0].padding + "\r\n\r\n" + path;
+    }
+    ASSERT_EQ(expected.size(), response.size());
+    ASSERT_TRUE(expected == response);
+}
+
+// A random string of n bytes drawn from chars
+static std::string randomString(std::mt19937& rng, size_t n,
+                                const std::string& chars)
+{
+    std::string s;
+    for (size_t ii = 0; ii < n; ii++) {
+        s += chars[rng() % chars.size()];
+    }
+    return s;
+}
+
+/*
+ * Random requests over one connection, split into pieces at random points,
+ * so that every part of a request (and, with a small HTTP_BUFFER_SIZE, of
+ * its longer lines) lands on a boundary sooner or later.
+ */
+TEST_F(HTTP_ServerTest, FuzzSplitPoints)
+{
+    static const std::string ALNUM = "abcdefghijklmnopqrstuvwxyz"
+                                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static const std::string VALUE = ALNUM + " -_.,;=/\"*";
+    static const size_t PIECES[] = {1, 2, 3, 5, 8, 13, 64, 200, 4096};
+
+    std::mt19937 rng(22);
+    Test_HTTP_Client& client = server.clients[0];
+    client.persistent = true;
+
+    for (int round = 0; round < 30; round++) {
+        std::string request;
+        std::string expected;
+        std::string body;
+        size_t count = 1 + rng() % 5;
+
+        for (size_t ii = 0; ii < count; ii++) {
+            if (0 < ii && 0 == rng() % 4) {
+                request += "\r\n";    // Stray blank line
+            }
+
+            std::string path = "/p" + randomString(rng, rng() % 40, ALNUM);
+            bool post = 0 == rng() % 2;
+            request += (post ? "POST " : "GET ") + path + " HTTP/1.1\r\n";
+
+            for (size_t jj = rng() % 4; jj > 0; jj--) {
+                request += "X-Fuzz-" + randomString(rng, 1 + rng() % 20, ALNUM)
+                         + ": " + randomString(rng, rng() % 200, VALUE) + "\r\n";
+            }
+            if (0 == rng() % 3) {
+                request += "host: " + randomString(rng, rng() % 30, ALNUM) + "\r\n";
+            }
+            if (count - 1 == ii) {
+                request += "Connection: close\r\n";
+            }
+
+            if (post && 0 == rng() % 2) {
+                request += "Transfer-Encoding: chunked\r\n\r\n";
+                for (size_t jj = rng() % 4; jj > 0; jj--) {
+                    std::string chunk = randomString(rng, 1 + rng() % 100, VALUE);
+                    char size[16];
+                    snprintf(size, sizeof(size), "%zx", chunk.size());
+                    request += std::string(size)
+                             + (0 == rng() % 3 ? ";ext=1" : "") + "\r\n"
+                             + chunk + "\r\n";
+                    body += chunk;
+                }
+                request += "0\r\n\r\n";
+            } else if (post) {
+                std::string data = randomString(rng, rng() % 300, VALUE);
+                request += "Content-Length: " + std::to_string(data.size())
+                         + "\r\n\r\n" + data;
+                body += data;
+            } else {
+                request += "\r\n";
+            }
+
+            expected += "HTTP/1.1 200 OK\r\nContent-Length: "
+                      + std::to_string(path.size()) + "\r\n\r\n" + path;
+        }
+
+        SCOPED_TRACE(request);
+        client.body.clear();
+        client.inPlace = round % 2;
+
+        int fd = connectClient();
+        ASSERT_LE(0, fd);
+
+        for (size_t ii = 0; ii < request.size(); ) {
+            size_t max = PIECES[rng() % (sizeof(PIECES) / sizeof(PIECES[0]))];
+            size_t n = std::min(request.size() - ii, 1 + rng() % max);
+            send(fd, request.data() + ii, n, 0);
+            ii += n;
+            server.tick();
+        }
+
+        ASSERT_EQ(expected, receive(fd));
+        ASSERT_EQ(body, client.body);
+        hangUp(fd);
+    }
+}
+
+TEST_F(HTTP_ServerTest, HTTP10ClosesByDefault)
+{
+    server.clients[0].persistent = true;
+
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a",
+              exchange("GET /a HTTP/1.0\r\n\r\n"));
+}
+
+TEST_F(HTTP_ServerTest, SeveralClients)
+{
+    int fds[3];
+    for (int ii = 0; ii < 3; ii++) {
+        fds[ii] = connectClient();
+        ASSERT_LE(0, fds[ii]);
+    }
+
+    // Send the requests out of order to make sure each client is tracked
+    for (int ii = 2; ii >= 0; ii--) {
+        std::string request = "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+        send(fds[ii], request.data(), request.size(), 0);
+    }
+
+    for (int ii = 0; ii < 3; ii++) {
+        ASSERT_EQ(RESPONSE, receive(fds[ii]));
+        close(fds[ii]);
+    }
+}
+
+TEST_F(HTTP_ServerTest, ReusesSlots)
+{
+    for (int ii = 0; ii < 20; ii++) {
+        ASSERT_EQ(RESPONSE, exchange("GET / HTTP/1.1\r\n\r\n"));
+    }
+}
+
+TEST_F(HTTP_ServerTest, ManyClients)
+{
+    const size_t n = 1000;
+    std::vector<int> fds;
+
+    for (size_t ii = 0; ii < n; ii++) {
+        int fd = connectClient();
+        ASSERT_LE(0, fd);
+        fds.push_back(fd);
+    }
+
+    // Only a few clients send a request; the idle ones must not hold up the
+    // rest.
+    for (size_t ii = 0; ii < n; ii += 100) {
+        std::string request = "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+        send(fds[ii], request.data(), request.size(), 0);
+    }
+
+    for (size_t ii = 0; ii < n; ii += 100) {
+        ASSERT_EQ(RESPONSE, receive(fds[ii]));
+    }
+
+    for (size_t ii = 0; ii < n; ii++) {
+        close(fds[ii]);
+    }
+}
+
+TEST_F(HTTP_ServerTest, ReturnsBuffers)
+{
+    ASSERT_EQ(RESPONSE, exchange(CHUNKED_REQUEST));
+    ASSERT_EQ(RESPONSE, exchangeSlowly(CHUNKED_REQUEST, 3));
+    ASSERT_EQ(HTTP_BUFFER_POOL_SIZE, server.buffersFree());
+}
+
+TEST_F(HTTP_ServerTest, MoreClientsThanBuffers)
+{
+    const size_t n = 2 * HTTP_BUFFER_POOL_SIZE;
+    std::vector<int> fds;
+
+    for (size_t ii = 0; ii < n; ii++) {
+        int fd = connectClient();
+        ASSERT_LE(0, fd);
+        fds.push_back(fd);
+    }
+
+    // Every request arrives before the server gets to any of them
+    for (size_t ii = 0; ii < n; ii++) {
+        std::string request = "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+        send(fds[ii], request.data(), request.size(), 0);
+    }
+
+    for (size_t ii = 0; ii < n; ii++) {
+        ASSERT_EQ(RESPONSE, receive(fds[ii]));
+        close(fds[ii]);
+    }
+
+    ASSERT_LT(0u, server.bufferWaits());
+    ASSERT_EQ(HTTP_BUFFER_POOL_SIZE, server.buffersFree());
+}
+
+TEST_F(HTTP_ServerTest, WaitersAreNotPolled)
+{
+    const size_t n = HTTP_BUFFER_POOL_SIZE + 4;
+    std::vector<int> fds;
+
+    for (size_t ii = 0; ii < n; ii++) {
+        server.clients[ii].stalled = true;
+        int fd = connectClient();
+        ASSERT_LE(0, fd);
+        fds.push_back(fd);
+    }
+    for (size_t ii = 0; ii < n; ii++) {
+        std::string request = "GET /" + std::to_string(ii) + " HTTP/1.1\r\n\r\n";
+        send(fds[ii], request.data(), request.size(), 0);
+    }
+
+    // The buffers stay with clients that don't read, so the rest wait; each
+    // only once, not on every tick
+    for (int ii = 0; ii < 50; ii++) {
+        server.tick();
+    }
+    ASSERT_EQ(0u, server.buffersFree());
+    ASSERT_EQ(4u, server.bufferWaits());
+
+    for (size_t ii = 0; ii < n; ii++) {
+        server.clients[ii].stalled = false;
+    }
+    for (size_t ii = 0; ii < n; ii++) {
+        ASSERT_EQ(RESPONSE, receive(fds[ii]));
+        close(fds[ii]);
+    }
+    ASSERT_EQ(HTTP_BUFFER_POOL_SIZE, server.buffersFree());
+}
+
+TEST_F(HTTP_ServerTest, IdleTimeout)
+{
+    HTTP_Timeouts timeouts;
+    timeouts.idle = 100;
+    server.timeouts(timeouts);
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    // Nothing comes, but the connection stays until the limit is up
+    server.tick();
+    server.tick(99);
+    ASSERT_TRUE(server.clients[0].connected());
+    ASSERT_EQ(0u, server.evictions());
+
+    server.tick(1);
+    ASSERT_EQ("", receive(fd));
+    close(fd);
+
+    ASSERT_EQ(http_status::FAIL_TIMEOUT, server.clients[0].failure);
+    ASSERT_EQ(1u, server.evictions());
+}
+
+TEST_F(HTTP_ServerTest, HeaderTimeout)
+{
+    HTTP_Timeouts timeouts;
+    timeouts.headers = 200;
+    server.timeouts(timeouts);
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    // Each byte comes well inside the idle limit, but the headers never end
+    std::string request = "GET / HTTP/1.1\r\nX-Slow: ";
+    send(fd, request.data(), request.size(), 0);
+
+    char buf[256];
+    ssize_t r = -1;
+    for (unsigned long start = millis(); 0 != r && millis() - start < 2000;) {
+        send(fd, "a", 1, MSG_NOSIGNAL);
+        for (int ii = 0; ii < 3; ii++) {
+            server.tick(10);
+        }
+        r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    }
+    close(fd);
+
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(http_status::FAIL_TIMEOUT, server.clients[0].failure);
+    ASSERT_EQ(1u, server.evictions());
+}
+
+TEST_F(HTTP_ServerTest, BodyTooSlow)
+{
+    HTTP_Timeouts timeouts;
+    timeouts.body = 100;
+    timeouts.bodyMinBytes = 16;
+    server.timeouts(timeouts);
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    std::string request = "POST /index.html HTTP/1.1\r\n"
+                          "Content-Length: 100\r\n"
+                          "\r\n"
+                          "abcd";
+    send(fd, request.data(), request.size(), 0);
+
+    // The body starts, and stops short of the minimum
+    for (int ii = 0; ii < 100 && "abcd" != server.clients[0].body; ii++) {
+        server.tick();
+    }
+    ASSERT_EQ("abcd", server.clients[0].body);
+    server.tick(100);
+    ASSERT_EQ("HTTP/1.1 ", receive(fd));
+    close(fd);
+
+    ASSERT_EQ(http_status::FAIL_TIMEOUT, server.clients[0].failure);
+    ASSERT_EQ("abcd", server.clients[0].body);
+    ASSERT_EQ(1u, server.evictions());
+}
+
+TEST_F(HTTP_ServerTest, BodySlowButSteady)
+{
+    HTTP_Timeouts timeouts;
+    timeouts.body = 100;
+    timeouts.bodyMinBytes = 16;
+    server.timeouts(timeouts);
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    std::string request = "POST /index.html HTTP/1.1\r\n"
+                          "Content-Length: 200\r\n"
+                          "\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    // 20 bytes every 50 ms, so a second in all
+    std::string body;
+    for (int ii = 0; ii < 10; ii++) {
+        std::string piece(20, 'a' + ii);
+        send(fd, piece.data(), piece.size(), 0);
+        body += piece;
+
+        for (int jj = 0; jj < 5; jj++) {
+            server.tick(10);
+        }
+    }
+
+    ASSERT_EQ(RESPONSE, receive(fd));
+    close(fd);
+
+    ASSERT_EQ(body, server.clients[0].body);
+    ASSERT_EQ(0u, server.evictions());
+}
+
+TEST_F(HTTP_ServerTest, CloseDoesNotWait)
+{
+    // Closing used to hold up every client for 100 ms
+    unsigned long start = millis();
+    for (int ii = 0; ii < 10; ii++) {
+        ASSERT_EQ(RESPONSE, exchange("GET / HTTP/1.1\r\n\r\n"));
+    }
+    ASSERT_GT(500u, millis() - start);
+}
+
+TEST_F(HTTP_ServerTest, CloseWithUnreadInput)
+{
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    // The response is sent, and the connection closed, while more input
+    // keeps arriving that nothing will read
+    std::string request = "POST /index.html HTTP/1.1\r\n"
+                          "Content-Length: 4\r\n"
+                          "\r\n"
+                          "abcd";
+    send(fd, request.data(), request.size(), 0);
+
+    std::string junk(1 << 16, 'x');
+    std::string response;
+    char buf[256];
+    for (unsigned long start = millis(); millis() - start < 5000;) {
+        send(fd, junk.data(), junk.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        server.tick();
+
+        ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (0 == r) {
+            break;
+        } else if (0 < r) {
+            response.append(buf, r);
+        }
+    }
+    close(fd);
+
+    ASSERT_EQ(RESPONSE, response);
+}
+
+TEST_F(HTTP_ServerTest, CloseTimeout)
+{
+    HTTP_Timeouts timeouts;
+    timeouts.close = 100;
+    server.timeouts(timeouts);
+
+    int fd = connectClient();
+    ASSERT_LE(0, fd);
+
+    std::string request = "GET / HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    // The peer takes the response, but never hangs up
+    ASSERT_EQ(RESPONSE, receive(fd));
+    for (unsigned long start = millis(); millis() - start < 2000
+            && server.clients[0].connected();) {
+        server.tick(10);
+    }
+    close(fd);
+
+    ASSERT_FALSE(server.clients[0].connected());
+    ASSERT_EQ(0u, server.evictions());
+}
+
+TEST_F(HTTP_ServerTest, TurnLoopsOverInput)
+{
+    server.clients[0].persistent = true;
+
+    // The whole lot arrives at once, and each process() only reads a piece
+    ASSERT_EQ("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/b"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/c",
+              exchange("GET /a HTTP/1.1\r\n\r\n"
+                       "GET /b HTTP/1.1\r\n\r\n"
+                       "GET /c HTTP/1.1\r\nConnection: close\r\n\r\n"));
+
+    const HTTP_SchedulerStats& stats = server.stats();
+    ASSERT_LT(stats.turns, stats.calls);
+    ASSERT_EQ(0u, stats.preempted);
+    ASSERT_LE(stats.maxWait, stats.totalWait);
+
+    server.resetStats();
+    ASSERT_EQ(0u, server.stats().calls);
+}
+
+TEST_F(HTTP_ServerTest, OneCallPerTurn)
+{
+    HTTP_Budget budget;
+    budget.bytes = 0;
+    server.budget(budget);
+
+    ASSERT_EQ(RESPONSE, exchange(CHUNKED_REQUEST));
+    ASSERT_EQ("Wikipedia in\r\n\r\nchunks.", server.clients[0].body);
+    ASSERT_EQ(server.stats().turns, server.stats().calls);
+}
+
+TEST_F(HTTP_ServerTest, BudgetEndsTurn)
+{
+    // Any headway ends the turn, if there's input left
+    HTTP_Budget budget;
+    budget.bytes = 1;
+    server.budget(budget);
+
+    std::string body(1000, 'x');
+    ASSERT_EQ(RESPONSE, exchange("POST /index.html HTTP/1.1\r\n"
+                                 "Content-Length: 1000\r\n"
+                                 "\r\n" + body));
+    ASSERT_EQ(body, server.clients[0].body);
+    ASSERT_LT(0u, server.stats().preempted);
+}
+
+TEST(HTTP_ServerStreamingTest, ResumeWithoutInput)
+{
+    Streaming_HTTP_Server server;
+    ASSERT_EQ(http_status::OKAY, server.begin());
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.port());
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                        sizeof(addr)));
+
+    std::string request = "GET / HTTP/1.0\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    std::string response;
+    char buf[256];
+    for (int ii = 0; ii < 10000; ii++) {
+        server.tick();
+
+        ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (0 == r) {
+            break;
+        } else if (0 < r) {
+            response.append(buf, r);
+        }
+    }
+    close(fd);
+
+    ASSERT_EQ("HTTP/1.0 200 OK\r\n\r\nchunkchunkchunkchunkchunk", response);
+}
+
+/*
+ * Answers with a header value of as much of value as the connection takes in
+ * one write, which backs it up, then steps through the rest of the response
+ * as the connection allows.
+ */
+class Backlog_HTTP_Client : public HTTP_Client
+{
+public:
+    std::string value;
+    size_t valueSent = 0;
+    unsigned long waits = 0;    // advanceTo()s that had to wait for room
+
+private:
+    bool _requested = false;
+    size_t _part = 0;
+
+protected:
+    virtual void process() override
+    {
+        if (!_requested) {
+            uint8_t buf[64];
+            size_t n_buf = sizeof(buf);
+            http_request_state state;
+            if (http_status::OKAY != read(buf, &n_buf, &state)
+                    || http_request_state::BODY != state) {
+                return;
+            }
+            _requested = true;
+
+            write(F("HTTP/1.1"));
+            advanceTo(http_response_state::STATUS_CODE);
+            write(F("200"));
+            advanceTo(http_response_state::STATUS_REASON);
+            write(F("OK"));
+            advanceTo(http_response_state::HEADER_NAME);
+            write(F("X-Big"));
+            advanceTo(http_response_state::HEADER_VALUE);
+            valueSent = write(reinterpret_cast<uint8_t*>(&value[0]),
+                                value.size());
+        }
+
+        static const http_response_state STATES[] = {
+            http_response_state::HEADER_NAME,
+            http_response_state::HEADER_VALUE,
+            http_response_state::BODY,
+        };
+        static const char* const TEXTS[] = {"X-After", "1", "done"};
+
+        for (; _part < 3; _part++) {
+            http_status status = advanceTo(STATES[_part]);
+            if (http_status::INCOMPLETE == status) {
+                waits++;
+                return;     // It called resume()
+            }
+            ASSERT_EQ(http_status::OKAY, status);
+            ASSERT_EQ(strlen(TEXTS[_part]), write(TEXTS[_part]));
+        }
+        close();
+    }
+};
+
+class Backlog_HTTP_Server : public Clocked_HTTP_Server
+{
+public:
+    Backlog_HTTP_Client clients[HTTP_MAX_CLIENTS];
+
+protected:
+    virtual HTTP_Client& client(size_t idx) override
+    {
+        return clients[idx];
+    }
+};
+
+class HTTP_BacklogTest : public HTTP_ServerFixture<Backlog_HTTP_Server> {};
+
+TEST_F(HTTP_BacklogTest, SeparatorsWaitForRoom)
+{
+    server.clients[0].value = std::string(8 << 20, 'x');
+
+    int fd = connectClient(4096);
+    ASSERT_LE(0, fd);
+    std::string request = "GET / HTTP/1.1\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+    for (int ii = 0; ii < 10; ii++) {
+        server.tick();
+    }
+
+    // Each separator went whole, once there was room for it
+    ASSERT_LT(0u, server.clients[0].waits);
+    std::string response = receive(fd);
+    hangUp(fd);
+
+    std::string expected = "HTTP/1.1 200 OK\r\nX-Big: "
+        + server.clients[0].value.substr(0, server.clients[0].valueSent)
+        + "\r\nX-After: 1\r\n\r\ndone";
+    ASSERT_EQ(expected.size(), response.size());
+    ASSERT_TRUE(expected == response);
+}
+
+// Serves the files under root, a block at a time
+class File_HTTP_Client : public HTTP_Client
+{
+public:
+    std::string root;
+
+private:
+    HTTP_File _file;
+    std::string _path;
+    bool _sending = false;
+
+protected:
+    virtual void process() override
+    {
+        if (_sending) {
+            uint8_t block[512];
+            http_status status = writeFile(_file, block, sizeof(block));
+            if (http_status::INCOMPLETE == status) {
+                return;
+            }
+
+            _sending = false;
+            _file.close();
+            if (http_status::OKAY == status) {
+                complete();
+            } else {
+                close();
+            }
+            return;
+        }
+
+        uint8_t buf[64];
+        size_t n_buf = sizeof(buf);
+
+        http_request_state state;
+        http_status status = read(buf, &n_buf, &state);
+
+        if (http_request_state::PATH == state) {
+            _path.append(reinterpret_cast<const char*>(buf), n_buf);
+        }
+
+        if (http_status::OKAY != status || http_request_state::BODY != state) {
+            return;
+        }
+
+        write(F("HTTP/1.1"));
+        advanceTo(http_response_state::STATUS_CODE);
+
+        if (!_file.open((root + _path).c_str())) {
+            write(F("404"));
+            advanceTo(http_response_state::STATUS_REASON);
+            write(F("Not Found"));
+            advanceTo(http_response_state::BODY);
+            complete();
+        } else if (respondWithFile(_file)) {
+            advanceTo(http_response_state::HEADER_NAME);
+            write(F("Content-Type"));
+            advanceTo(http_response_state::HEADER_VALUE);
+            write(F("text/plain"));
+            _sending = true;
+            resume();
+        } else {
+            _file.close();
+            advanceTo(http_response_state::BODY);
+            complete();
+        }
+        _path.clear();
+    }
+};
+
+class File_HTTP_Server : public Clocked_HTTP_Server
+{
+public:
+    File_HTTP_Client clients[HTTP_MAX_CLIENTS];
+
+protected:
+    virtual HTTP_Client& client(size_t idx) override
+    {
+        return clients[idx];
+    }
+};
+
+class HTTP_FileTest : public HTTP_ServerFixture<File_HTTP_Server>
+{
+protected:
+    std::string dir;
+    std::string contents;
+
+    virtual void SetUp() override
+    {
+        HTTP_ServerFixture<File_HTTP_Server>::SetUp();
+
+        char tmpl[] = "/tmp/shockfileXXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(tmpl));
+        dir = tmpl;
+        server.clients[0].root = dir;
+
+        // Several blocks, not a whole number of them
+        for (size_t ii = 0; contents.size() < 5000; ii++) {
+            contents += std::to_string(ii) + "\n";
+        }
+        FILE* f = fopen((dir + "/data.txt").c_str(), "w");
+        ASSERT_NE(nullptr, f);
+        fwrite(contents.data(), 1, contents.size(), f);
+        fclose(f);
+    }
+
+    virtual void TearDown() override
+    {
+        unlink((dir + "/data.txt").c_str());
+        rmdir(dir.c_str());
+    }
+
+    // The value of a header in response, or "" if it isn't there
+    static std::string header(const std::string& response,
+                                const std::string& name)
+    {
+        size_t start = response.find("\r\n" + name + ": ");
+        if (std::string::npos == start) {
+            return std::string();
+        }
+        start += name.size() + 4;
+        return response.substr(start, response.find("\r\n", start) - start);
+    }
+};
+
+TEST_F(HTTP_FileTest, ServesFile)
+{
+    std::string response = exchange("GET /data.txt HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "\r\n");
+
+    ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    ASSERT_EQ(std::to_string(contents.size()), header(response, "Content-Length"));
+    ASSERT_EQ("text/plain", header(response, "Content-Type"));
+    ASSERT_NE("", header(response, "ETag"));
+    ASSERT_EQ(contents, response.substr(response.find("\r\n\r\n") + 4));
+}
+
+TEST_F(HTTP_FileTest, IfNoneMatch)
+{
+    std::string etag = header(exchange("GET /data.txt HTTP/1.1\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n"), "ETag");
+    ASSERT_NE("", etag);
+
+    // Split up so the tag is hashed over several pieces
+    ASSERT_EQ("HTTP/1.1 304 Not Modified\r\nETag: " + etag + "\r\n\r\n",
+                exchangeSlowly("GET /data.txt HTTP/1.1\r\n"
+                                "Connection: close\r\n"
+                                "If-None-Match: " + etag + "\r\n"
+                                "\r\n", 5));
+
+    std::string response = exchange("GET /data.txt HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "If-None-Match: \"1-2\"\r\n"
+                                    "\r\n");
+    ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    ASSERT_EQ(contents, response.substr(response.find("\r\n\r\n") + 4));
+}
+
+TEST_F(HTTP_FileTest, IfNoneMatchList)
+{
+    std::string etag = header(exchange("GET /data.txt HTTP/1.1\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n"), "ETag");
+    ASSERT_EQ(0u, etag.find("W/\""));
+    std::string opaque = etag.substr(2);
+    std::string notModified = "HTTP/1.1 304 Not Modified\r\nETag: " + etag
+                                + "\r\n\r\n";
+
+    const std::string matching[] = {
+        opaque,                                 // Weak comparison
+        "\"1-2\", " + etag,
+        "\"1-2\",W/\"3-4\" ,\t" + opaque + " ",
+        "junk, , " + etag,
+        "*",
+    };
+    for (const std::string& value : matching) {
+        ASSERT_EQ(notModified,
+                    exchangeSlowly("GET /data.txt HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "If-None-Match: " + value + "\r\n"
+                                    "\r\n", 3)) << value;
+    }
+
+    // Across repeated headers
+    ASSERT_EQ(notModified,
+                exchange("GET /data.txt HTTP/1.1\r\n"
+                            "Connection: close\r\n"
+                            "If-None-Match: \"1-2\"\r\n"
+                            "If-None-Match: " + etag + "\r\n"
+                            "\r\n"));
+
+    std::string tooMany;
+    for (size_t ii = 0; ii < HTTP_IF_NONE_MATCH_TAGS; ii++) {
+        tooMany += "\"" + std::to_string(ii) + "\", ";
+    }
+    const std::string modified[] = {
+        "\"1-2\"",
+        "W" + opaque,                           // Not a weak tag
+        "\"" + opaque,                          // Opaque tag in the quotes
+        opaque.substr(0, opaque.size() - 1),    // Never closed
+        tooMany + etag,                         // Past what's kept
+    };
+    for (const std::string& value : modified) {
+        std::string response = exchange("GET /data.txt HTTP/1.1\r\n"
+                                        "Connection: close\r\n"
+                                        "If-None-Match: " + value + "\r\n"
+                                        "\r\n");
+        ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n")) << value;
+    }
+}
+
+TEST_F(HTTP_FileTest, ETagChangesWithFile)
+{
+    std::string request = "GET /data.txt HTTP/1.1\r\n"
+                            "Connection: close\r\n"
+                            "\r\n";
+    std::string etag = header(exchange(request), "ETag");
+
+    // Same size, different bytes, and a new file in its place
+    std::string path = dir + "/data.txt";
+    unlink(path.c_str());
+    contents[contents.size() - 2] ^= 1;
+    FILE* f = fopen(path.c_str(), "w");
+    ASSERT_NE(nullptr, f);
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+
+    std::string response = exchange("GET /data.txt HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "If-None-Match: " + etag + "\r\n"
+                                    "\r\n");
+    ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    ASSERT_NE(etag, header(response, "ETag"));
+    ASSERT_EQ(contents, response.substr(response.find("\r\n\r\n") + 4));
+}
+
+TEST_F(HTTP_FileTest, LargeFileToSlowReader)
+{
+    std::string large;
+    while (large.size() < 8 << 20) {
+        large += contents;
+    }
+    std::string path = dir + "/large.txt";
+    FILE* f = fopen(path.c_str(), "w");
+    ASSERT_NE(nullptr, f);
+    fwrite(large.data(), 1, large.size(), f);
+    fclose(f);
+
+    int fd = connectClient(4096);
+    ASSERT_LE(0, fd);
+    std::string request = "GET /large.txt HTTP/1.1\r\n"
+                            "Connection: close\r\n"
+                            "\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    // More than the socket buffers hold, so the server gets backed up and
+    // stops sending; blocks are only read as there's room for them, so
+    // none go missing while it waits
+    unsigned long flushes = 0;
+    for (int still = 0; still < 5;) {
+        server.tick();
+        still = flushes == server.clients[0].flushes() ? still + 1 : 0;
+        flushes = server.clients[0].flushes();
+    }
+    std::string response = receive(fd);
+    hangUp(fd);
+    unlink(path.c_str());
+
+    ASSERT_EQ(std::to_string(large.size()), header(response, "Content-Length"));
+    std::string body = response.substr(response.find("\r\n\r\n") + 4);
+    ASSERT_EQ(large.size(), body.size());
+    ASSERT_TRUE(large == body);
+}
+
+TEST_F(HTTP_FileTest, Head)
+{
+    std::string response = exchange("HEAD /data.txt HTTP/1.1\r\n"
+                                    "Connection: close\r\n"
+                                    "\r\n");
+
+    ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    ASSERT_EQ(std::to_string(contents.size()), header(response, "Content-Length"));
+    ASSERT_EQ(response.size(), response.find("\r\n\r\n") + 4);
+}
+
+TEST_F(HTTP_FileTest, NotFound)
+{
+    ASSERT_EQ("HTTP/1.1 404 Not Found\r\n\r\n",
+                exchange("GET /missing.txt HTTP/1.1\r\n"
+                            "Connection: close\r\n"
+                            "\r\n"));
+    ASSERT_EQ("HTTP/1.1 404 Not Found\r\n\r\n",
+                exchange("GET / HTTP/1.1\r\n"
+                            "Connection: close\r\n"
+                            "\r\n"));
+}
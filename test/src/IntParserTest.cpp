@@ -1,6 +1,16 @@
 #include <gtest/gtest.h>
 #include "IntParser.h"
 
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const uint8_t* bytes(const std::string& s)
+{
+    return reinterpret_cast<const uint8_t*>(s.data());
+}
+
 TEST(IntParserTest, create)
 {
     IntParser p;
@@ -65,3 +75,228 @@ TEST(IntParserTest, invalid)
     ASSERT_FALSE(p.value(&x));
     ASSERT_TRUE(p.invalid());
 }
+
+TEST(IntParserTest, hex)
+{
+    IntParser p;
+    p.reset(16);
+
+    for (char x : std::string("1aF0")) {
+        p.next(x);
+    }
+
+    uintmax_t v;
+    ASSERT_TRUE(p.value(&v));
+    ASSERT_EQ(0x1af0u, v);
+}
+
+TEST(IntParserTest, hex_max)
+{
+    IntParser p;
+    p.reset(16);
+
+    for (size_t ii = 0; ii < 2 * sizeof(uintmax_t); ii++) {
+        p.next('f');
+    }
+
+    uintmax_t v;
+    ASSERT_TRUE(p.value(&v));
+    ASSERT_EQ(UINTMAX_MAX, v);
+
+    p.next('0');
+    ASSERT_FALSE(p.value(&v));
+    ASSERT_TRUE(p.overflowed());
+}
+
+TEST(IntParserTest, hex_invalid)
+{
+    IntParser p;
+    p.reset(16);
+    p.next('g');
+
+    uintmax_t x;
+    ASSERT_FALSE(p.value(&x));
+    ASSERT_TRUE(p.invalid());
+}
+
+TEST(IntParserTest, decimal_rejects_hex)
+{
+    IntParser p;
+    p.reset(16);
+    p.reset();
+    p.next('a');
+
+    uintmax_t x;
+    ASSERT_FALSE(p.value(&x));
+    ASSERT_TRUE(p.invalid());
+}
+
+TEST(IntParserTest, feed)
+{
+    IntParser p;
+    std::string s = "1234567890123";
+    p.feed(bytes(s), s.size());
+
+    uintmax_t v;
+    ASSERT_TRUE(p.value(&v));
+    ASSERT_EQ(1234567890123u, v);
+}
+
+TEST(IntParserTest, feed_matches_next)
+{
+    const std::string inputs[] = {
+        "", "0", "7", "12345678", "123456789", "00000000000000000042",
+        std::to_string(UINTMAX_MAX), "1" + std::to_string(UINTMAX_MAX),
+        std::to_string(UINTMAX_MAX / 10) + "6", "12a4", "1234567/", ":",
+        "9999999999999999999", "99999999999999999999",
+    };
+
+    for (const std::string& s : inputs) {
+        // Every way of splitting the input over two calls
+        for (size_t split = 0; split <= s.size(); split++) {
+            SCOPED_TRACE(s + " split at " + std::to_string(split));
+
+            IntParser bytewise;
+            for (char c : s) {
+                bytewise.next(c);
+            }
+
+            IntParser fed;
+            fed.feed(bytes(s), split);
+            fed.feed(bytes(s) + split, s.size() - split);
+
+            uintmax_t a = 0;
+            uintmax_t b = 0;
+            ASSERT_EQ(bytewise.value(&a), fed.value(&b));
+            ASSERT_EQ(bytewise.overflowed(), fed.overflowed());
+            ASSERT_EQ(bytewise.invalid(), fed.invalid());
+            if (!bytewise.overflowed() && !bytewise.invalid()) {
+                ASSERT_EQ(a, b);
+            }
+        }
+    }
+}
+
+TEST(IntParserTest, feed_hex)
+{
+    IntParser p;
+    p.reset(16);
+
+    std::string s = "DeadBeef01";
+    p.feed(bytes(s), s.size());
+
+    uintmax_t v;
+    ASSERT_TRUE(p.value(&v));
+    ASSERT_EQ(0xdeadbeef01u, v);
+}
+
+template<typename T>
+class IntParserWidthTest : public ::testing::Test {};
+
+typedef ::testing::Types<uint16_t, uint32_t, uintmax_t> IntParserWidths;
+TYPED_TEST_CASE(IntParserWidthTest, IntParserWidths);
+
+TYPED_TEST(IntParserWidthTest, max)
+{
+    const TypeParam max = static_cast<TypeParam>(-1);
+    std::string s = std::to_string(max);
+
+    BasicIntParser<TypeParam> bytewise;
+    for (char c : s) {
+        bytewise.next(c);
+    }
+
+    BasicIntParser<TypeParam> fed;
+    fed.feed(bytes(s), s.size());
+
+    TypeParam v;
+    ASSERT_TRUE(bytewise.value(&v));
+    ASSERT_EQ(max, v);
+    ASSERT_TRUE(fed.value(&v));
+    ASSERT_EQ(max, v);
+}
+
+TYPED_TEST(IntParserWidthTest, overflow)
+{
+    const TypeParam max = static_cast<TypeParam>(-1);
+
+    // One more than the max (which always ends in 5), and the max with
+    // another digit
+    std::string inputs[] = {std::to_string(max), std::to_string(max) + "0"};
+    inputs[0].back()++;
+
+    for (const std::string& s : inputs) {
+        SCOPED_TRACE(s);
+
+        BasicIntParser<TypeParam> bytewise;
+        for (char c : s) {
+            bytewise.next(c);
+        }
+
+        BasicIntParser<TypeParam> fed;
+        fed.feed(bytes(s), s.size());
+
+        ASSERT_TRUE(bytewise.overflowed());
+        ASSERT_TRUE(fed.overflowed());
+    }
+}
+
+TYPED_TEST(IntParserWidthTest, hex_max)
+{
+    BasicIntParser<TypeParam> p;
+    p.reset(16);
+
+    for (size_t ii = 0; ii < 2 * sizeof(TypeParam); ii++) {
+        p.next('F');
+    }
+
+    TypeParam v;
+    ASSERT_TRUE(p.value(&v));
+    ASSERT_EQ(static_cast<TypeParam>(-1), v);
+
+    p.next('0');
+    ASSERT_TRUE(p.overflowed());
+}
+
+TEST(IntParserTest, BenchmarkContentLengths)
+{
+    // Content-Length values of typical sizes, from a few bytes to megabytes
+    std::vector<std::string> lengths;
+    for (uintmax_t v = 1; v < 100000000; v = v * 7 + 3) {
+        lengths.push_back(std::to_string(v));
+    }
+
+    const size_t rounds = 20000;
+    uintmax_t check[2] = {0, 0};
+    double rate[2];
+
+    for (int mode = 0; mode < 2; mode++) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t ii = 0; ii < rounds; ii++) {
+            for (const std::string& s : lengths) {
+                IntParser p;
+                if (0 == mode) {
+                    for (char c : s) {
+                        p.next(c);
+                    }
+                } else {
+                    p.feed(bytes(s), s.size());
+                }
+
+                uintmax_t v;
+                p.value(&v);
+                check[mode] += v;
+            }
+        }
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        rate[mode] = rounds * lengths.size() / elapsed.count();
+    }
+
+    std::cout << "[ BENCH    ] next(): " << rate[0] << " numbers/s, feed(): "
+              << rate[1] << " numbers/s" << std::endl;
+
+    ASSERT_EQ(check[0], check[1]);
+}
@@ -1,6 +1,11 @@
 #include "gtest/gtest.h"
 #include "RingBuffer.h"
 #include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <vector>
 
 using std::size_t;
 
@@ -9,12 +14,14 @@ class Readable
 private:
     uint16_t _total = UINT16_MAX;
     uint16_t _current = 0;
+    size_t _calls = 0;
 
 public:
     Readable() = default;
     explicit Readable(uint16_t total) : _total(total) {}
     int read(void* buf, uint16_t count, uint32_t f = 0) {
         (void)f;
+        _calls++;
         uint8_t *b = static_cast<uint8_t*>(buf);
 
         uint16_t x = _total-_current;
@@ -28,6 +35,7 @@ public:
     }
 
     int read() {
+        _calls++;
         if (_current >= _total) {
             return -1;
         }
@@ -36,14 +44,53 @@ public:
     }
 
     uint16_t available() {
+        _calls++;
         return _total - _current;
     }
 
-    bool connected() { return true; }
+    bool connected() { _calls++; return true; }
 
     void reset() {
         _current = 0;
     }
+
+    size_t calls() const { return _calls; }
+};
+
+class BulkReadable : public Readable
+{
+public:
+    using Readable::Readable;
+};
+
+template<>
+struct RingBufferTraits<BulkReadable>
+{
+    static const bool bulkRead = true;
+};
+
+// Sink that takes at most `limit` bytes per write
+class Writable
+{
+private:
+    size_t _limit;
+    size_t _calls = 0;
+
+public:
+    std::vector<uint8_t> data;
+
+    explicit Writable(size_t limit = SIZE_MAX) : _limit(limit) {}
+
+    size_t write(const void* buf, uint16_t count, uint32_t f = 0) {
+        (void)f;
+        _calls++;
+        const uint8_t* b = static_cast<const uint8_t*>(buf);
+        size_t n = std::min(static_cast<size_t>(count), _limit);
+        data.insert(data.end(), b, b + n);
+        return n;
+    }
+
+    size_t calls() const { return _calls; }
 };
 
 TEST(RingBufferTest, Capacity)
@@ -206,6 +253,97 @@ TEST(RingBufferTest, ReadUntilNoMatch)
     }
 }
 
+TEST(RingBufferTest, ReadUntilWrapped)
+{
+    RingBuffer<100> a;
+    Readable r;
+
+    a.readFrom(r);
+    uint8_t buffer[100];
+    a.read(buffer, 90);
+    a.readFrom(r);
+
+    // 90..99 at the end of the buffer, 100..189 at the front; the match at
+    // 120 comes back in one call.
+    ASSERT_EQ(31, a.readUntil(buffer, 120, 100));
+    for (size_t ii = 0; ii < 31; ii++) {
+        ASSERT_EQ(90 + ii, buffer[ii]);
+    }
+    ASSERT_EQ(121, a.read());
+}
+
+TEST(RingBufferTest, FindAcrossSegments)
+{
+    RingBuffer<100> a;
+    Readable r;
+
+    a.readFrom(r);
+    uint8_t buffer[100];
+    a.read(buffer, 90);
+    a.readFrom(r);
+
+    ASSERT_EQ(5, a.find(95));
+    ASSERT_EQ(30, a.find(120));
+    ASSERT_EQ(100, a.find(200)); // Not there
+
+    const uint8_t terms[] = {150, 110, 97};
+    ASSERT_EQ(7, a.find(terms));
+    ASSERT_EQ(100, a.available()); // Nothing consumed
+}
+
+TEST(RingBufferTest, ReadToEndEmpties)
+{
+    RingBuffer<100> a;
+    Readable r;
+
+    a.readFrom(r);
+    uint8_t buffer[100];
+    a.read(buffer, 50);
+
+    // Reading up to the end of the buffer leaves it empty, not full
+    ASSERT_EQ(50, a.read(buffer, 100));
+    ASSERT_EQ(0, a.available());
+    ASSERT_EQ(100, a.readFrom(r));
+}
+
+TEST(RingBufferTest, PeekSpansEmpty)
+{
+    RingBuffer<100> a;
+    RingBufferSpan spans[2];
+
+    ASSERT_EQ(0, a.peekSpans(spans));
+}
+
+TEST(RingBufferTest, PeekSpansWrapped)
+{
+    RingBuffer<100> a;
+    Readable r;
+
+    a.readFrom(r);
+    uint8_t buffer[100];
+    a.read(buffer, 90);
+    a.readFrom(r);
+
+    RingBufferSpan spans[2];
+    ASSERT_EQ(2, a.peekSpans(spans));
+    ASSERT_EQ(10, spans[0].length);
+    ASSERT_EQ(90, spans[1].length);
+    ASSERT_EQ(90, spans[0].data[0]);
+    ASSERT_EQ(100, spans[1].data[0]);
+
+    // Peeking takes nothing
+    ASSERT_EQ(100, a.available());
+
+    a.consume(15);
+    ASSERT_EQ(1, a.peekSpans(spans));
+    ASSERT_EQ(85, spans[0].length);
+    ASSERT_EQ(105, spans[0].data[0]);
+
+    a.consume(85);
+    ASSERT_EQ(0, a.available());
+    ASSERT_EQ(0, a.peekSpans(spans));
+}
+
 TEST(RingBufferTest, PutBackEmpty)
 {
     RingBuffer<100> a;
@@ -239,3 +377,526 @@ TEST(RingBufferTest, PutBackFull)
         ASSERT_EQ(ii+1, a.read());
     }
 }
+
+TEST(RingBufferTest, BulkReadIntoFull)
+{
+    RingBuffer<100> a;
+    BulkReadable r;
+
+    ASSERT_EQ(100, a.readFrom(r));
+    ASSERT_EQ(1, r.calls());
+    ASSERT_EQ(100, a.available());
+
+    for (size_t ii = 0; ii < 100; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    ASSERT_GT(0, a.read());
+}
+
+TEST(RingBufferTest, BulkReadIntoSome)
+{
+    RingBuffer<100> a;
+    BulkReadable r(34);
+
+    ASSERT_EQ(34, a.readFrom(r));
+    ASSERT_EQ(34, a.available());
+
+    // The source ran dry, so no second read is attempted
+    ASSERT_EQ(1, r.calls());
+
+    for (size_t ii = 0; ii < 34; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    ASSERT_GT(0, a.read());
+}
+
+TEST(RingBufferTest, BulkReadIntoEmpty)
+{
+    RingBuffer<100> a;
+    BulkReadable r(0);
+
+    ASSERT_EQ(0, a.readFrom(r));
+    ASSERT_GT(0, a.read());
+}
+
+TEST(RingBufferTest, BulkReadIntoWrapped)
+{
+    RingBuffer<100> a;
+    BulkReadable r;
+
+    a.readFrom(r);
+
+    for (size_t ii = 0; ii < 30; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    // Tail segment is full, so only the 30 bytes at the head are free
+    size_t before = r.calls();
+    ASSERT_EQ(30, a.readFrom(r));
+    ASSERT_EQ(1, r.calls() - before);
+    ASSERT_EQ(100, a.available());
+
+    for (size_t ii = 30; ii < 130; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    ASSERT_GT(0, a.read());
+}
+
+TEST(RingBufferTest, BulkReadIntoBothSegments)
+{
+    RingBuffer<100> a;
+    BulkReadable r(50);
+
+    a.readFrom(r);
+
+    for (size_t ii = 0; ii < 20; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    // 50 bytes free at the tail and 20 at the head: two block reads
+    BulkReadable more;
+    ASSERT_EQ(70, a.readFrom(more));
+    ASSERT_EQ(2, more.calls());
+    ASSERT_EQ(100, a.available());
+
+    for (size_t ii = 20; ii < 50; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    for (size_t ii = 0; ii < 70; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    ASSERT_GT(0, a.read());
+}
+
+TEST(RingBufferTest, ReadIntoWrappedHead)
+{
+    RingBuffer<100> a;
+    Readable r;
+
+    a.readFrom(r);
+
+    for (size_t ii = 0; ii < 60; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+
+    ASSERT_EQ(60, a.readFrom(r));
+    ASSERT_EQ(100, a.available());
+
+    for (size_t ii = 60; ii < 160; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+}
+
+TEST(RingBufferTest, BenchmarkReadFromBytesPerCall)
+{
+    const size_t rounds = 1000;
+    RingBuffer<100> a;
+    uint8_t buffer[100];
+
+    Readable slow;
+    size_t slowBytes = 0;
+    for (size_t ii = 0; ii < rounds; ii++) {
+        slowBytes += a.readFrom(slow);
+        a.read(buffer, 37);
+        a.read(buffer, 37);
+    }
+
+    a.clear();
+
+    BulkReadable fast;
+    size_t fastBytes = 0;
+    for (size_t ii = 0; ii < rounds; ii++) {
+        fastBytes += a.readFrom(fast);
+        a.read(buffer, 37);
+        a.read(buffer, 37);
+    }
+
+    double slowRate = static_cast<double>(slowBytes) / slow.calls();
+    double fastRate = static_cast<double>(fastBytes) / fast.calls();
+
+    std::cout << "[ BENCH    ] per-byte readFrom: " << slowRate
+              << " bytes/call, bulk readFrom: " << fastRate
+              << " bytes/call" << std::endl;
+
+    ASSERT_EQ(slowBytes, fastBytes);
+    ASSERT_GT(fastRate, slowRate);
+}
+
+TEST(RingBufferTest, WriteIntoEmpty)
+{
+    RingBuffer<100> a;
+    uint8_t src[40];
+    for (size_t ii = 0; ii < sizeof(src); ii++) {
+        src[ii] = ii;
+    }
+
+    ASSERT_EQ(40, a.write(src, sizeof(src)));
+    ASSERT_EQ(40, a.available());
+
+    for (size_t ii = 0; ii < 40; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+}
+
+TEST(RingBufferTest, WriteIntoFull)
+{
+    RingBuffer<100> a;
+    uint8_t src[150] = {0};
+
+    ASSERT_EQ(100, a.write(src, sizeof(src)));
+    ASSERT_EQ(100, a.available());
+    ASSERT_EQ(0, a.write(src, 1));
+}
+
+TEST(RingBufferTest, WriteWraps)
+{
+    RingBuffer<100> a;
+    uint8_t src[100];
+    for (size_t ii = 0; ii < sizeof(src); ii++) {
+        src[ii] = ii;
+    }
+
+    a.write(src, 80);
+    uint8_t dest[50];
+    ASSERT_EQ(50, a.read(dest, 50));
+
+    // 20 bytes fit at the end, 50 more at the front
+    ASSERT_EQ(70, a.write(src, 100));
+    ASSERT_EQ(100, a.available());
+
+    for (size_t ii = 50; ii < 80; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+    for (size_t ii = 0; ii < 70; ii++) {
+        ASSERT_EQ(ii, a.read());
+    }
+}
+
+TEST(RingBufferTest, WriteToDrains)
+{
+    RingBuffer<100> a;
+    Writable w;
+    uint8_t src[140];
+    for (size_t ii = 0; ii < sizeof(src); ii++) {
+        src[ii] = ii;
+    }
+
+    a.write(src, 60);
+    uint8_t dest[50];
+    a.read(dest, 50);
+    a.write(src + 60, 80);
+
+    // One write for the tail segment, one for the wrapped head
+    ASSERT_EQ(90, a.writeTo(w));
+    ASSERT_EQ(2, w.calls());
+    ASSERT_EQ(0, a.available());
+
+    for (size_t ii = 0; ii < 90; ii++) {
+        ASSERT_EQ(ii + 50, w.data[ii]);
+    }
+}
+
+TEST(RingBufferTest, WriteToShortSink)
+{
+    RingBuffer<100> a;
+    Writable w(30);
+    uint8_t src[50] = {0};
+
+    a.write(src, sizeof(src));
+
+    ASSERT_EQ(30, a.writeTo(w));
+    ASSERT_EQ(1, w.calls());
+    ASSERT_EQ(20, a.available());
+}
+
+TEST(RingBufferTest, PooledAttachDetach)
+{
+    PooledRingBuffer<16> a;
+    uint8_t first[16];
+    uint8_t second[16];
+    uint8_t buffer[4];
+
+    ASSERT_FALSE(a.attached());
+    ASSERT_EQ(0, a.available());
+    ASSERT_EQ(-1, a.peek());
+
+    a.attach(first);
+    ASSERT_TRUE(a.attached());
+    ASSERT_EQ(3, a.write("abc", 3));
+    ASSERT_EQ('a', first[0]);
+    ASSERT_EQ(2, a.read(buffer, 2));
+
+    // Whatever was left goes with the block
+    ASSERT_EQ(first, a.detach());
+    ASSERT_FALSE(a.attached());
+    ASSERT_EQ(0, a.available());
+
+    a.attach(second);
+    ASSERT_EQ(2, a.write("de", 2));
+    ASSERT_EQ('d', second[0]);
+    ASSERT_EQ('d', a.read());
+}
+
+// Both index schemes, checked against a plain queue
+template<typename B>
+class RingBufferModelTest : public ::testing::Test {};
+
+typedef ::testing::Types<RingBuffer<100>, RingBuffer<128>, RingBuffer<1>,
+                         RingBuffer<2>, SpscRingBuffer<64> > RingBufferTypes;
+TYPED_TEST_CASE(RingBufferModelTest, RingBufferTypes);
+
+TYPED_TEST(RingBufferModelTest, MatchesQueue)
+{
+    TypeParam a;
+    std::deque<uint8_t> model;
+    uint8_t next = 0;
+    uint8_t buffer[256];
+
+    srand(1);
+    for (int ii = 0; ii < 10000; ii++) {
+        size_t n = rand() % (a.capacity() + 2);
+
+        switch (rand() % 4) {
+            case 0: {
+                for (size_t jj = 0; jj < n; jj++) {
+                    buffer[jj] = next + jj;
+                }
+                size_t count = a.write(buffer, n);
+                ASSERT_EQ(std::min(n, a.capacity() - model.size()), count);
+                for (size_t jj = 0; jj < count; jj++) {
+                    model.push_back(next++);
+                }
+                break;
+            }
+            case 1: {
+                size_t count = a.read(buffer, n);
+                ASSERT_GE(model.size(), count);
+                for (size_t jj = 0; jj < count; jj++) {
+                    ASSERT_EQ(model.front(), buffer[jj]);
+                    model.pop_front();
+                }
+                break;
+            }
+            case 2: {
+                // The byte at offset n if there is one, else one not there
+                uint8_t c = n < model.size() ? model[n] : next;
+                size_t count = a.readUntil(buffer, c, a.capacity());
+                ASSERT_EQ(n < model.size() ? n + 1 : model.size(), count);
+                for (size_t jj = 0; jj < count; jj++) {
+                    ASSERT_EQ(model.front(), buffer[jj]);
+                    model.pop_front();
+                }
+                break;
+            }
+            default: {
+                RingBufferSpan spans[2];
+                size_t n_spans = a.peekSpans(spans);
+                size_t offset = 0;
+                for (size_t jj = 0; jj < n_spans; jj++) {
+                    for (size_t kk = 0; kk < spans[jj].length; kk++) {
+                        ASSERT_EQ(model[offset++], spans[jj].data[kk]);
+                    }
+                }
+                ASSERT_EQ(model.size(), offset);
+
+                n = std::min(n, model.size());
+                a.consume(n);
+                model.erase(model.begin(), model.begin() + n);
+                break;
+            }
+        }
+
+        ASSERT_EQ(model.size(), a.available());
+        ASSERT_EQ(model.empty() ? -1 : model.front(), a.peek());
+    }
+}
+
+TYPED_TEST(RingBufferModelTest, PutBackAfterWrap)
+{
+    TypeParam a;
+    uint8_t buffer[256] = {0};
+
+    for (size_t ii = 0; ii < 3 * a.capacity() + 1; ii++) {
+        ASSERT_EQ(1, a.write(buffer, 1));
+        ASSERT_EQ(0, a.read());
+    }
+
+    a.putBack('x');
+    ASSERT_EQ(1, a.available());
+    ASSERT_EQ('x', a.read());
+    ASSERT_EQ(0, a.available());
+}
+
+TYPED_TEST(RingBufferModelTest, PutBackWhenFull)
+{
+    TypeParam a;
+    uint8_t buffer[256];
+    for (size_t ii = 0; ii < a.capacity(); ii++) {
+        buffer[ii] = ii;
+    }
+
+    // Full both from the start and after wrapping around
+    for (size_t offset = 0; offset < 2; offset++) {
+        a.clear();
+        a.write(buffer, offset);
+        a.read(buffer + 128, offset);
+        ASSERT_EQ(a.capacity(), a.write(buffer, a.capacity()));
+
+        ASSERT_FALSE(a.putBack('x'));
+        ASSERT_EQ(a.capacity(), a.available());
+        for (size_t ii = 0; ii < a.capacity(); ii++) {
+            ASSERT_EQ(ii, a.read());
+        }
+
+        ASSERT_EQ(-1, a.read());
+        ASSERT_TRUE(a.putBack('x'));
+        ASSERT_EQ('x', a.read());
+    }
+}
+
+TEST(RingBufferTest, SpscSingleThread)
+{
+    SpscRingBuffer<64> a;
+    uint8_t buffer[100];
+
+    for (size_t ii = 0; ii < sizeof(buffer); ii++) {
+        buffer[ii] = ii;
+    }
+
+    ASSERT_EQ(64, a.write(buffer, 100));
+    ASSERT_EQ(64, a.available());
+    ASSERT_EQ(0, a.write(buffer, 1));
+
+    ASSERT_EQ(40, a.read(buffer, 40));
+    ASSERT_EQ(40, a.write(buffer, 40));
+    ASSERT_EQ(64, a.available());
+
+    // Wrapped: 40..63, then 0..39
+    ASSERT_EQ(24, a.readUntil(buffer, 63, 100));
+    ASSERT_EQ(39, a.find(39));
+    a.putBack(63);
+    ASSERT_EQ(63, a.read());
+}
+
+// Counts up from wherever it's told to start, in blocks
+class Sequence
+{
+public:
+    uint8_t next = 0;
+    size_t left = 0;
+
+    int read(void* buf, uint16_t count) {
+        uint8_t* b = static_cast<uint8_t*>(buf);
+        if (count > left) {
+            count = left;
+        }
+        for (uint16_t ii = 0; ii < count; ii++) {
+            b[ii] = next++;
+        }
+        left -= count;
+        return count;
+    }
+};
+
+template<>
+struct RingBufferTraits<Sequence>
+{
+    static const bool bulkRead = true;
+};
+
+/*
+ * One thread fills the buffer while another drains it, mixing the calls each
+ * side makes. Every byte must come out once, in order.
+ */
+TEST(RingBufferTest, SpscStress)
+{
+    static SpscRingBuffer<256> a;
+    const size_t total = 1 << 22;
+
+    std::thread producer([&]() {
+        uint8_t buffer[97];
+        size_t sent = 0;
+        Sequence source;
+
+        while (sent < total) {
+            size_t n = 1 + sent % sizeof(buffer);
+            if (n > total - sent) {
+                n = total - sent;
+            }
+
+            if (0 == sent % 3) {
+                // Through readFrom, as the transport would
+                source.next = sent;
+                source.left = total - sent;
+                n = a.readFrom(source);
+            } else {
+                for (size_t ii = 0; ii < n; ii++) {
+                    buffer[ii] = sent + ii;
+                }
+                n = a.write(buffer, n);
+            }
+
+            if (0 == n) {
+                std::this_thread::yield(); // Full, let the consumer run
+            }
+            sent += n;
+        }
+    });
+
+    size_t received = 0;
+    size_t misplaced = total; // First byte out of order
+    uint8_t buffer[64];
+
+    // Keeps draining after a mistake, or the producer would never finish
+    while (received < total) {
+        size_t n = 0;
+
+        switch (received % 4) {
+            case 0:
+                n = a.read(buffer, sizeof(buffer));
+                break;
+            case 1:
+                n = a.readUntil(buffer, 0, sizeof(buffer));
+                break;
+            case 2: {
+                int c = a.read();
+                if (0 <= c) {
+                    buffer[0] = c;
+                    n = 1;
+                }
+                break;
+            }
+            default: {
+                RingBufferSpan spans[2];
+                if (0 < a.peekSpans(spans)) {
+                    n = std::min(spans[0].length, sizeof(buffer));
+                    memcpy(buffer, spans[0].data, n);
+                    a.consume(n);
+                }
+                break;
+            }
+        }
+
+        if (0 == n) {
+            std::this_thread::yield(); // Empty, let the producer run
+        }
+
+        for (size_t ii = 0; ii < n && total == misplaced; ii++) {
+            if (static_cast<uint8_t>(received + ii) != buffer[ii]) {
+                misplaced = received + ii;
+            }
+        }
+        received += n;
+    }
+
+    producer.join();
+
+    ASSERT_EQ(total, misplaced);
+    ASSERT_EQ(total, received);
+    ASSERT_EQ(0, a.available());
+}
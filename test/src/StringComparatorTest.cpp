@@ -0,0 +1,165 @@
+#include "gtest/gtest.h"
+#include "StringComparator.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+constexpr const char* const HEADERS[] = {"Transfer-Encoding", "Content-Length",
+                                        "Connection", "Content-Type", "Host",
+                                        "Expect"};
+
+static StringComparator headers = STRING_COMPARATOR(HEADERS);
+
+static bool match(StringComparator& comparator, const char* str, size_t& idx)
+{
+    StringComparison c = comparator.create();
+    for (; *str; str++) {
+        c.next(*str);
+    }
+    return c.hasMatch(idx);
+}
+
+TEST(StringComparatorTest, Matches)
+{
+    size_t idx;
+
+    ASSERT_TRUE(match(headers, "Transfer-Encoding", idx));
+    ASSERT_EQ(0, idx);
+    ASSERT_TRUE(match(headers, "Content-Length", idx));
+    ASSERT_EQ(1, idx);
+    ASSERT_TRUE(match(headers, "Content-Type", idx));
+    ASSERT_EQ(3, idx);
+    ASSERT_TRUE(match(headers, "Expect", idx));
+    ASSERT_EQ(5, idx);
+}
+
+TEST(StringComparatorTest, NoMatch)
+{
+    size_t idx;
+
+    ASSERT_FALSE(match(headers, "", idx));
+    ASSERT_FALSE(match(headers, "Content", idx));
+    ASSERT_FALSE(match(headers, "Content-Lengths", idx));
+    ASSERT_FALSE(match(headers, "Accept", idx));
+}
+
+constexpr const char* const PREFIXES[] = {"abc", "ab"};
+
+TEST(StringComparatorTest, PrefixOfAnother)
+{
+    StringComparator comparator = STRING_COMPARATOR(PREFIXES);
+
+    size_t idx;
+    ASSERT_TRUE(match(comparator, "ab", idx));
+    ASSERT_EQ(1, idx);
+    ASSERT_TRUE(match(comparator, "abc", idx));
+    ASSERT_EQ(0, idx);
+}
+
+constexpr const char* const MANY[] = {
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language",
+    "Authorization", "Cache-Control", "Connection", "Content-Length",
+    "Content-Type", "Cookie", "Expect", "Host", "If-Modified-Since",
+    "If-None-Match", "Range", "Referer", "Transfer-Encoding", "User-Agent",
+};
+
+TEST(StringComparatorTest, ManyStrings)
+{
+    StringComparator comparator = STRING_COMPARATOR(MANY);
+    const size_t n = sizeof(MANY) / sizeof(MANY[0]);
+
+    for (size_t ii = 0; ii < n; ii++) {
+        size_t idx;
+        ASSERT_TRUE(match(comparator, MANY[ii], idx)) << MANY[ii];
+        ASSERT_EQ(ii, idx);
+    }
+
+    size_t idx;
+    ASSERT_FALSE(match(comparator, "Accept-", idx));
+    ASSERT_FALSE(match(comparator, "If-Match", idx));
+
+    // One state per distinct prefix, plus the dead state
+    ASSERT_GE(256u, (StringDfa<MANY, n>::STATES));
+}
+
+TEST(StringComparatorTest, CaseSensitiveByDefault)
+{
+    size_t idx;
+    ASSERT_FALSE(match(headers, "content-length", idx));
+    ASSERT_FALSE(match(headers, "HOST", idx));
+}
+
+TEST(StringComparatorTest, NoCase)
+{
+    StringComparator comparator = STRING_COMPARATOR_NOCASE(HEADERS);
+
+    size_t idx;
+    ASSERT_TRUE(match(comparator, "content-length", idx));
+    ASSERT_EQ(1, idx);
+    ASSERT_TRUE(match(comparator, "TRANSFER-ENCODING", idx));
+    ASSERT_EQ(0, idx);
+    ASSERT_TRUE(match(comparator, "hOsT", idx));
+    ASSERT_EQ(4, idx);
+    ASSERT_FALSE(match(comparator, "content_length", idx));
+
+    // Folding shares classes instead of adding them
+    ASSERT_EQ((StringDfa<HEADERS, 6>::STATES),
+              (StringDfa<HEADERS, 6, true>::STATES));
+    ASSERT_GT((StringDfa<HEADERS, 6>::CLASSES),
+              (StringDfa<HEADERS, 6, true>::CLASSES));
+}
+
+TEST(StringComparatorTest, Reset)
+{
+    StringComparison c = headers.create();
+    c.next('X');
+    c.reset();
+
+    for (const char* p = "Host"; *p; p++) {
+        c.next(*p);
+    }
+
+    size_t idx;
+    ASSERT_TRUE(c.hasMatch(idx));
+    ASSERT_EQ(4, idx);
+}
+
+TEST(StringComparatorTest, Empty)
+{
+    StringComparison c;
+    c.next('a');
+
+    size_t idx;
+    ASSERT_FALSE(c.hasMatch(idx));
+}
+
+TEST(StringComparatorTest, BenchmarkHeadersPerSecond)
+{
+    // Header names as a typical browser sends them
+    static const char* const names[] = {
+        "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding",
+        "Connection", "Content-Type", "Content-Length", "Cookie",
+        "Upgrade-Insecure-Requests",
+    };
+    const size_t n_names = sizeof(names) / sizeof(names[0]);
+    const size_t rounds = 100000;
+
+    size_t matched = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t ii = 0; ii < rounds; ii++) {
+        size_t idx;
+        if (match(headers, names[ii % n_names], idx)) {
+            matched++;
+        }
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << "[ BENCH    ] " << rounds / elapsed.count()
+              << " header names/s" << std::endl;
+
+    ASSERT_EQ(rounds / n_names * 4, matched);
+}
@@ -0,0 +1,92 @@
+#include "gtest/gtest.h"
+#include "TimerWheel.h"
+
+#include <climits>
+#include <set>
+
+TEST(TimerWheelTest, ExpiresInOrderOfTime)
+{
+    TimerWheel<4, 8, 16> wheel;
+    wheel.schedule(0, 1000);
+    wheel.schedule(1, 1040);
+    wheel.schedule(2, 1005);
+
+    ASSERT_EQ(4u, wheel.expire(999));
+    ASSERT_EQ(0u, wheel.expire(1000));
+    ASSERT_EQ(4u, wheel.expire(1004));
+
+    ASSERT_EQ(2u, wheel.expire(1010));
+    ASSERT_FALSE(wheel.scheduled(2));
+    ASSERT_EQ(4u, wheel.expire(1039));
+
+    ASSERT_EQ(1u, wheel.expire(5000));
+    ASSERT_EQ(4u, wheel.expire(5000));
+}
+
+TEST(TimerWheelTest, SameSlot)
+{
+    TimerWheel<4, 8, 16> wheel;
+    for (size_t ii = 0; ii < 4; ii++) {
+        wheel.schedule(ii, 100 + ii);
+    }
+
+    std::set<size_t> expired;
+    for (size_t idx; 4 != (idx = wheel.expire(200));) {
+        expired.insert(idx);
+    }
+    ASSERT_EQ(4u, expired.size());
+}
+
+TEST(TimerWheelTest, MoreThanOneTurnAway)
+{
+    // A turn of the wheel is 128 ms
+    TimerWheel<2, 8, 16> wheel;
+    wheel.expire(0);
+    wheel.schedule(0, 20);
+    wheel.schedule(1, 20 + 3 * 128);
+
+    ASSERT_EQ(0u, wheel.expire(20));
+    for (unsigned long now = 20; now < 20 + 3 * 128; now += 7) {
+        ASSERT_EQ(2u, wheel.expire(now));
+    }
+    ASSERT_EQ(1u, wheel.expire(20 + 3 * 128));
+}
+
+TEST(TimerWheelTest, CancelAndReschedule)
+{
+    TimerWheel<3, 8, 16> wheel;
+    wheel.schedule(0, 50);
+    wheel.schedule(1, 50);
+    wheel.schedule(2, 50);
+
+    wheel.cancel(1);
+    ASSERT_FALSE(wheel.scheduled(1));
+    wheel.schedule(2, 500);
+    ASSERT_EQ(500u, wheel.deadline(2));
+
+    ASSERT_EQ(0u, wheel.expire(100));
+    ASSERT_EQ(3u, wheel.expire(100));
+    ASSERT_EQ(2u, wheel.expire(500));
+}
+
+TEST(TimerWheelTest, ScheduledInThePast)
+{
+    TimerWheel<1, 8, 16> wheel;
+    wheel.expire(1000);
+    wheel.schedule(0, 10);
+    ASSERT_EQ(0u, wheel.expire(1000));
+}
+
+TEST(TimerWheelTest, ClockWraps)
+{
+    TimerWheel<2, 8, 16> wheel;
+    unsigned long start = ULONG_MAX - 40;
+    wheel.expire(start);
+    wheel.schedule(0, start + 30);
+    wheel.schedule(1, start + 100);   // Past the wrap
+
+    ASSERT_EQ(2u, wheel.expire(start + 29));
+    ASSERT_EQ(0u, wheel.expire(start + 30));
+    ASSERT_EQ(2u, wheel.expire(start + 99));
+    ASSERT_EQ(1u, wheel.expire(start + 100));
+}